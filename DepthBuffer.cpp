@@ -0,0 +1,248 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  DepthBuffer.cpp
+//  ------------------------
+//  
+//  A minimal class for a depth buffer, stored tightly
+//  packed as 16-bit or 24-bit fixed point, or 32-bit float
+//  
+///////////////////////////////////////////////////
+
+#define MAX_IMAGE_DIMENSION 4096
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+
+#include "DepthBuffer.h"
+
+// largest value of each fixed point format
+#define DEPTH_MAX_16 0xFFFF
+#define DEPTH_MAX_24 0xFFFFFF
+
+// converts a depth in [0, 1] to fixed point with the given largest value, rounding to the nearest step
+// scaling to 32 fractional bits is exact in a float (bar depths below 2^-8, which lose bits under 2^-32),
+// and the rounding is then done in integers, as a float can't hold every 24 bit value
+template <unsigned int maximum>
+static inline unsigned int QuantiseFixed(float depth)
+    { // QuantiseFixed()
+    depth = (depth < 0.0f) ? 0.0f : (1.0f < depth) ? 1.0f : depth;
+    unsigned long long fraction = (unsigned long long) (depth * 4294967296.0f);
+    return (unsigned int) ((fraction * maximum + 0x80000000ULL) >> 32);
+    } // QuantiseFixed()
+
+// constructor
+DepthBuffer::DepthBuffer()
+    :
+    block(NULL),
+    width(0),
+    height(0),
+    format(DEPTH_BUFFER_24),
+    bytesPerPixel(3),
+    testAndSet(&DepthBuffer::TestAndSet24)
+    { // DepthBuffer constructor
+    } // DepthBuffer constructor
+
+// copy constructor
+DepthBuffer::DepthBuffer(const DepthBuffer &other)
+    : DepthBuffer()
+    { // copy constructor
+    *this = other;
+    } // copy constructor
+
+// copy assignment
+DepthBuffer &DepthBuffer::operator = (const DepthBuffer &other)
+    { // operator =
+    if (this == &other)
+        return *this;
+
+    // match the other buffer's format & size, then copy all of the pixels
+    if (SetFormat(other.format) && Resize(other.width, other.height) && (other.block != NULL))
+        memcpy(block, other.block, width * height * bytesPerPixel);
+
+    return *this;
+    } // operator =
+
+// destructor
+DepthBuffer::~DepthBuffer()
+    { // DepthBuffer destructor
+    // release the memory
+    free(block);
+    } // DepthBuffer destructor
+
+// resizes the buffer, destroying any contents
+bool DepthBuffer::Resize(long Width, long Height)
+    { // Resize()
+    // check validity of dimensions
+    if ((Width < 0) || (Width > MAX_IMAGE_DIMENSION) || (Height < 0) || (Height > MAX_IMAGE_DIMENSION))
+        { // failure 
+        std::cout << "Cannot handle depth buffer of size " << Width << " x " << Height << std::endl;
+        return false;
+        } // failure
+
+    // if our old block is non-null
+    if (block != NULL)
+        // release the old pointer
+        free(block);
+
+    // use calloc() to allocate & zero memory
+    block = (unsigned char *) calloc(Height * Width, bytesPerPixel);
+    if (block == NULL)
+        return false;
+
+    // set the dimensions
+    width = Width;
+    height = Height;
+
+    // start out with everything at the far plane
+    Clear(1.0);
+    return true;
+    } // Resize()
+
+// changes the storage format, destroying any contents
+bool DepthBuffer::SetFormat(unsigned int Format)
+    { // SetFormat()
+    switch (Format)
+        { // switch on format
+        case DEPTH_BUFFER_16:
+            bytesPerPixel = 2;
+            testAndSet = &DepthBuffer::TestAndSet16;
+            break;
+        case DEPTH_BUFFER_24:
+            bytesPerPixel = 3;
+            testAndSet = &DepthBuffer::TestAndSet24;
+            break;
+        case DEPTH_BUFFER_32F:
+            bytesPerPixel = 4;
+            testAndSet = &DepthBuffer::TestAndSet32F;
+            break;
+        default:
+            std::cout << "Unknown depth buffer format " << Format << std::endl;
+            return false;
+        } // switch on format
+    format = Format;
+
+    // reallocate at the same size
+    return Resize(width, height);
+    } // SetFormat()
+
+// sets every pixel to the same depth in [0, 1]
+void DepthBuffer::Clear(float depth)
+    { // Clear()
+    Fill(0, width * height, depth);
+    } // Clear()
+
+// sets the pixels of a rectangle to the same depth, bounds inclusive & within the buffer
+void DepthBuffer::Clear(float depth, int firstRow, int lastRow, int firstCol, int lastCol)
+    { // Clear()
+    if (firstCol > lastCol)
+        return;
+    for (int row = firstRow; row <= lastRow; row++)
+        Fill(row * width + firstCol, lastCol - firstCol + 1, depth);
+    } // Clear()
+
+// sets count pixels in a row from first to the same depth
+void DepthBuffer::Fill(long first, long count, float depth)
+    { // Fill()
+    if (block == NULL)
+        return;
+
+    switch (format)
+        { // switch on format
+        case DEPTH_BUFFER_16:
+            std::fill((unsigned short *) block + first, (unsigned short *) block + first + count, (unsigned short) Quantise(depth));
+            break;
+        case DEPTH_BUFFER_24:
+            { // 24 bit
+            unsigned int value = Quantise(depth);
+            unsigned char low = value & 0xFF, middle = (value >> 8) & 0xFF, high = value >> 16;
+            // the usual clear values are all zero or all one bits, so one memset does it
+            if ((low == middle) && (middle == high))
+                memset(block + 3 * first, low, count * 3);
+            else
+                for (long pixel = first; pixel < first + count; pixel++)
+                    { // per pixel
+                    block[3 * pixel] = low;
+                    block[3 * pixel + 1] = middle;
+                    block[3 * pixel + 2] = high;
+                    } // per pixel
+            break;
+            } // 24 bit
+        case DEPTH_BUFFER_32F:
+            std::fill((float *) block + first, (float *) block + first + count, depth);
+            break;
+        } // switch on format
+    } // Fill()
+
+// converts a depth in [0, 1] to the value stored for it
+unsigned int DepthBuffer::Quantise(float depth) const
+    { // Quantise()
+    if (format == DEPTH_BUFFER_16)
+        return QuantiseFixed<DEPTH_MAX_16>(depth);
+    else
+        return QuantiseFixed<DEPTH_MAX_24>(depth);
+    } // Quantise()
+
+// the depth stored at a pixel, in [0, 1]
+float DepthBuffer::Depth(int row, int col) const
+    { // Depth()
+    long pixel = (long) row * width + col;
+    switch (format)
+        { // switch on format
+        case DEPTH_BUFFER_16:
+            return ((unsigned short *) block)[pixel] / (float) DEPTH_MAX_16;
+        case DEPTH_BUFFER_24:
+            { // 24 bit
+            const unsigned char *stored = block + 3 * pixel;
+            return (stored[0] | (stored[1] << 8) | (stored[2] << 16)) / (float) DEPTH_MAX_24;
+            } // 24 bit
+        default:
+            return ((float *) block)[pixel];
+        } // switch on format
+    } // Depth()
+
+// if depth is no further than the stored value, stores it & returns true
+// a depth that isn't a number never passes
+bool DepthBuffer::TestAndSet16(long pixel, float depth)
+    { // TestAndSet16()
+    if (depth != depth)
+        return false;
+    unsigned short value = QuantiseFixed<DEPTH_MAX_16>(depth);
+    unsigned short &stored = ((unsigned short *) block)[pixel];
+    if (value > stored)
+        return false;
+    stored = value;
+    return true;
+    } // TestAndSet16()
+
+bool DepthBuffer::TestAndSet24(long pixel, float depth)
+    { // TestAndSet24()
+    if (depth != depth)
+        return false;
+    unsigned int value = QuantiseFixed<DEPTH_MAX_24>(depth);
+    unsigned char *stored = block + 3 * pixel;
+    if (value > (unsigned int) (stored[0] | (stored[1] << 8) | (stored[2] << 16)))
+        return false;
+    stored[0] = value & 0xFF;
+    stored[1] = (value >> 8) & 0xFF;
+    stored[2] = value >> 16;
+    return true;
+    } // TestAndSet24()
+
+bool DepthBuffer::TestAndSet32F(long pixel, float depth)
+    { // TestAndSet32F()
+    // a NaN fails this comparison, so it never passes either
+    float &stored = ((float *) block)[pixel];
+    if (!(depth <= stored))
+        return false;
+    stored = depth;
+    return true;
+    } // TestAndSet32F()
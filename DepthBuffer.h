@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  DepthBuffer.h
+//  ------------------------
+//  
+//  A minimal class for a depth buffer, stored tightly
+//  packed as 16-bit or 24-bit fixed point, or 32-bit float
+//  
+///////////////////////////////////////////////////
+
+#ifndef DEPTHBUFFER_H
+#define DEPTHBUFFER_H
+
+// constants for the storage format, named by bits per pixel
+const unsigned int DEPTH_BUFFER_16 = 16;
+const unsigned int DEPTH_BUFFER_24 = 24;
+const unsigned int DEPTH_BUFFER_32F = 32;
+
+// the class itself
+class DepthBuffer
+    { // class DepthBuffer
+    public:
+    // the raw data, bytesPerPixel bytes for each pixel with no padding
+    unsigned char *block;
+
+    // dimensions of the buffer
+    long width, height;
+
+    // the storage format & its size
+    unsigned int format;
+    unsigned int bytesPerPixel;
+
+    // the depth test for the format, picked by SetFormat() so that testing a fragment doesn't switch on it
+    bool (DepthBuffer::*testAndSet)(long pixel, float depth);
+
+    // constructor
+    DepthBuffer();
+
+    // copy constructor
+    DepthBuffer(const DepthBuffer &other);
+
+    // copy assignment
+    DepthBuffer &operator = (const DepthBuffer &other);
+
+    // destructor
+    ~DepthBuffer();
+
+    // resizes the buffer, destroying any contents
+    bool Resize(long Width, long Height);
+
+    // changes the storage format, destroying any contents
+    bool SetFormat(unsigned int Format);
+
+    // sets every pixel to the same depth in [0, 1]
+    void Clear(float depth);
+
+    // sets the pixels of a rectangle to the same depth, bounds inclusive & within the buffer
+    void Clear(float depth, int firstRow, int lastRow, int firstCol, int lastCol);
+
+    // sets count pixels in a row from first to the same depth
+    void Fill(long first, long count, float depth);
+
+    // converts a depth in [0, 1] to the value stored for it
+    unsigned int Quantise(float depth) const;
+
+    // the depth stored at a pixel, in [0, 1]
+    float Depth(int row, int col) const;
+
+    // if depth is no further than the stored value, stores it & returns true
+    bool TestAndSet(int row, int col, float depth)
+        { // TestAndSet()
+        return (this->*testAndSet)((long) row * width + col, depth);
+        } // TestAndSet()
+
+    // the same for a pixel of each format, comparing the stored values directly
+    bool TestAndSet16(long pixel, float depth);
+    bool TestAndSet24(long pixel, float depth);
+    bool TestAndSet32F(long pixel, float depth);
+
+    }; // class DepthBuffer
+
+#endif
@@ -15,7 +15,31 @@
 ///////////////////////////////////////////////////
 
 #include "FakeGL.h"
+#include "FastMath.h"
 #include <math.h>
+#include <algorithm>
+
+//-------------------------------------------------//
+//                                                 //
+// VERTEX ATTRIBUTE ARRAYS                         //
+//                                                 //
+//-------------------------------------------------//
+
+// constructor
+vertexAttributeArray::vertexAttributeArray()
+    : enabled(0), size(0), stride(0), pointer(NULL)
+    { // constructor
+    } // constructor
+
+// retrieves the start of the element at a given index
+const float * vertexAttributeArray::operator [](const unsigned int index) const
+    { // operator []
+    // a stride of 0 means the elements are packed one after the other
+    if (stride == 0)
+        return pointer + index * size;
+    // otherwise step through the bytes
+    return (const float *) ((const char *) pointer + index * stride);
+    } // operator []
 
 //-------------------------------------------------//
 //                                                 //
@@ -29,7 +53,6 @@ FakeGL::FakeGL()
       projectionStack(1, Matrix4()),
       lightPosition(0.0, 0.0, 1.0, 0.0),
       attributeColour((float)1.0, (float)1.0, (float)1.0, (float)1.0),
-      depthColour((float)0.0, (float)0.0, (float)0.0, (float)255.0),
       attributeNormal(0, 0, 1)
     { // constructor
 
@@ -40,13 +63,29 @@ FakeGL::FakeGL()
     // matrix state 
     viewPortSize = xPixelOrigin = yPixelOrigin = 0;
 
+    // as in OpenGL, the scissor box starts out as the window, which for us is the first viewport,
+    // & follows the viewport until Scissor() is called
+    scissorX = scissorY = scissorWidth = scissorHeight = 0;
+    scissorSet = 0;
+
     // init state variables
     lighting = texture = depthTest = 0;
     phongShading = 1;
+    deferredPipeline = 0;
+    visibilityShading = 0;
+    visibilityBase = FAKEGL_NO_TRIANGLE;
+    boundShader = NULL;
+    boundAttributes = boundDeferred = 0;
+    cullFace = 0;
+    cullFaceMode = FAKEGL_BACK;
+    frontFace = FAKEGL_CCW;
+    scissorTest = 0;
+    shadingPrecision = FAKEGL_NICEST;
 
     // raster state
     primitive = -1; // TODO CHANGE FROM -1
     pointSize = lineWidth = 1;
+    SetupPointSpans();
 
     // set lighting properties to general defaults, we don't init for light0 
     ambientLight[0] = ambientLight[1] = ambientLight[2] = 0.0;
@@ -62,15 +101,29 @@ FakeGL::FakeGL()
     emissiveMat[0] = emissiveMat[1] = emissiveMat[2] = 0.0;
     // don't forget alphas
     ambientMat[3] = diffuseMat[3] = specularMat[3] = emissiveMat[3] = 1.0;
+    flushCount = 0;
+    materialDirty = 0;
+    SetCurrentMaterial();
 
     // texture state
     attributeU = attributeV = 0;
+    texMode = FAKEGL_MODULATE;
+
+    // vertex array state
+    drawCount = 0;
+    vertexCacheHits = vertexCacheMisses = 0;
+
+    // raster statistics
+    ResetRasterStatistics();
 
     // buffer state, update at each projection call
     // initialise depth values
     nearVal = 1.0;
     farVal = -1.0;
 
+    // clear the depth buffer to the far plane
+    clearDepth = 1.0;
+
     } // constructor
 
 // destructor
@@ -88,6 +141,15 @@ FakeGL::~FakeGL()
 void FakeGL::Begin(unsigned int PrimitiveType)
     { // Begin()
     primitive = PrimitiveType;
+    ResolveMaterial();
+
+    // in deferred mode, the vertices up to End() are recorded in a batch of their own
+    if (deferredPipeline)
+        BeginDeferredBatch(PrimitiveType);
+    // otherwise they are shaded with the state as it is now, but with the light constants referred to,
+    // so that material changes up to End() still apply
+    else
+        ShadingState(rasterShading);
     } // Begin()
 
 // ends a sequence of geometric primitives
@@ -100,6 +162,7 @@ void FakeGL::End()
 void FakeGL::PointSize(float size)
     { // PointSize()
     pointSize = (round(size) > 0) ? round(size) : 1;
+    SetupPointSpans();
     } // PointSize()
 
 // sets the width of a line for drawing purposes
@@ -342,8 +405,30 @@ void FakeGL::Viewport(int x, int y, int width, int height)
     // set pixel origin accordingly
     xPixelOrigin = x + (width / 2.0 - viewPortSize / 2.0);
     yPixelOrigin = y + (height / 2.0 - viewPortSize / 2.0);
+
+    // the scissor box follows the window until it is set for itself
+    if (!scissorSet)
+        {
+        scissorX = x;
+        scissorY = y;
+        scissorWidth = width;
+        scissorHeight = height;
+        }
     } // Viewport()
 
+// sets the scissor box used when FAKEGL_SCISSOR_TEST is enabled
+void FakeGL::Scissor(int x, int y, int width, int height)
+    { // Scissor()
+    // GL_INVALID_VALUE is generated if either width or height is negative. 
+    if ((width < 0) || (height < 0)) return;
+
+    scissorX = x;
+    scissorY = y;
+    scissorWidth = width;
+    scissorHeight = height;
+    scissorSet = 1;
+    } // Scissor()
+
 //-------------------------------------------------//
 //                                                 //
 // VERTEX ATTRIBUTE ROUTINES                       //
@@ -381,6 +466,9 @@ void FakeGL::Materialf(unsigned int parameterName, const float parameterValue)
 
     if (parameterName & FAKEGL_SHININESS)
         exponent = parameterValue;
+
+    // vertices from now on have the new material, looked up when the next one comes
+    materialDirty = 1;
     } // Materialf()
 
 void FakeGL::Materialfv(unsigned int parameterName, const float *parameterValues)
@@ -414,6 +502,9 @@ void FakeGL::Materialfv(unsigned int parameterName, const float *parameterValues
         emissiveMat[2] = parameterValues[2];
         emissiveMat[3] = parameterValues[3];
         }
+
+    // vertices from now on have the new material, looked up when the next one comes
+    materialDirty = 1;
     } // Materialfv()
 
 // sets the normal vector
@@ -435,6 +526,8 @@ void FakeGL::TexCoord2f(float u, float v)
 // sets the vertex & launches it down the pipeline
 void FakeGL::Vertex3f(float x, float y, float z)
     { // Vertex3f()
+    // pick up any material changes since the last vertex
+    ResolveMaterial();
 
     // create the new attribute vertex
     vertexWithAttributes vertex;
@@ -446,14 +539,19 @@ void FakeGL::Vertex3f(float x, float y, float z)
     vertex.normal.w = 0.0;
     vertex.u = attributeU;
     vertex.v = attributeV;
-    vertex.ambient = ambientMat;
-    vertex.diffuse = diffuseMat;
-    vertex.specular = specularMat;
-    vertex.emissive = emissiveMat;
-    vertex.exponent = exponent;
+    vertex.material = currentMaterial;
 
+    // in deferred mode we just record the vertex
+    if (deferredPipeline)
+        {
+        // vertices outside Begin() / End() don't belong to any primitive
+        if (deferredBatches.empty() || (primitive != deferredBatches.back().primitive))
+            return;
 
-    //std::cout << vertex.u << " " << vertex.v << std::endl;
+        deferredVertices.push_back(vertex);
+        deferredBatches.back().vertexCount++;
+        return;
+        }
 
     // push it to the back of the queue
     vertexQueue.push_back(vertex);
@@ -469,6 +567,230 @@ void FakeGL::Vertex3f(float x, float y, float z)
         
     } // Vertex3f()
 
+//-------------------------------------------------//
+//                                                 //
+// VERTEX ARRAY ROUTINES                           //
+//                                                 //
+//-------------------------------------------------//
+
+// enables a client-side vertex array
+void FakeGL::EnableClientState(unsigned int array)
+    { // EnableClientState()
+    switch (array)
+        {
+        case FAKEGL_VERTEX_ARRAY:
+            vertexArray.enabled = 1;
+            break;
+        case FAKEGL_NORMAL_ARRAY:
+            normalArray.enabled = 1;
+            break;
+        case FAKEGL_TEXTURE_COORD_ARRAY:
+            texCoordArray.enabled = 1;
+            break;
+        case FAKEGL_COLOR_ARRAY:
+            colourArray.enabled = 1;
+            break;
+        default:
+            break;
+        }
+    } // EnableClientState()
+
+// disables a client-side vertex array
+void FakeGL::DisableClientState(unsigned int array)
+    { // DisableClientState()
+    switch (array)
+        {
+        case FAKEGL_VERTEX_ARRAY:
+            vertexArray.enabled = 0;
+            break;
+        case FAKEGL_NORMAL_ARRAY:
+            normalArray.enabled = 0;
+            break;
+        case FAKEGL_TEXTURE_COORD_ARRAY:
+            texCoordArray.enabled = 0;
+            break;
+        case FAKEGL_COLOR_ARRAY:
+            colourArray.enabled = 0;
+            break;
+        default:
+            break;
+        }
+    } // DisableClientState()
+
+// sets the array of vertex positions (size is 2, 3 or 4)
+void FakeGL::VertexPointer(int size, int stride, const float *pointer)
+    { // VertexPointer()
+    // GL_INVALID_VALUE is generated if size is not 2, 3, or 4 or if stride is negative
+    if ((size < 2) || (size > 4) || (stride < 0)) return;
+
+    vertexArray.size = size;
+    vertexArray.stride = stride;
+    vertexArray.pointer = pointer;
+    } // VertexPointer()
+
+// sets the array of normals (always 3 floats)
+void FakeGL::NormalPointer(int stride, const float *pointer)
+    { // NormalPointer()
+    // GL_INVALID_VALUE is generated if stride is negative
+    if (stride < 0) return;
+
+    normalArray.size = 3;
+    normalArray.stride = stride;
+    normalArray.pointer = pointer;
+    } // NormalPointer()
+
+// sets the array of texture coordinates (size is at least 2, extra components ignored)
+void FakeGL::TexCoordPointer(int size, int stride, const float *pointer)
+    { // TexCoordPointer()
+    // we only support 2D textures, so we need at least u and v
+    if ((size < 2) || (size > 4) || (stride < 0)) return;
+
+    texCoordArray.size = size;
+    texCoordArray.stride = stride;
+    texCoordArray.pointer = pointer;
+    } // TexCoordPointer()
+
+// sets the array of colours (size is 3 or 4)
+void FakeGL::ColorPointer(int size, int stride, const float *pointer)
+    { // ColorPointer()
+    // GL_INVALID_VALUE is generated if size is not 3 or 4 or if stride is negative
+    if ((size < 3) || (size > 4) || (stride < 0)) return;
+
+    colourArray.size = size;
+    colourArray.stride = stride;
+    colourArray.pointer = pointer;
+    } // ColorPointer()
+
+// draws count sequential vertices from the enabled arrays, starting at first
+void FakeGL::DrawArrays(unsigned int mode, int first, int count)
+    { // DrawArrays()
+    // nothing is drawn without positions
+    if (!vertexArray.enabled || (first < 0) || (count <= 0)) return;
+    ResolveMaterial();
+
+    // in deferred mode, copy the vertices into a batch of their own
+    if (deferredPipeline)
+        {
+        BeginDeferredBatch(mode);
+        unsigned int attributes = VertexAttributes();
+        deferredVertices.resize(deferredVertices.size() + count);
+        for (int element = 0; element < count; element++)
+            {
+            vertexWithAttributes &vertex = deferredVertices[deferredBatches.back().firstVertex + element];
+            FetchVertex(first + element, vertex, attributes);
+            }
+        deferredBatches.back().vertexCount = count;
+        return;
+        }
+
+    // transform stage: run the whole batch through in one go
+    screenVertexBatch batch = VertexBatch(count, VertexAttributes());
+    TransformElements(first, NULL, count, batch);
+
+    // raster & fragment stages
+    RasteriseBatch(mode, batch, NULL, count);
+    } // DrawArrays()
+
+// draws count vertices from the enabled arrays, looked up through indices
+void FakeGL::DrawElements(unsigned int mode, int count, const unsigned int *indices)
+    { // DrawElements()
+    // nothing is drawn without positions
+    if (!vertexArray.enabled || (indices == NULL) || (count <= 0)) return;
+    ResolveMaterial();
+
+    // find out how many array elements are referenced
+    unsigned int maxIndex = 0;
+    for (int element = 0; element < count; element++)
+        if (indices[element] > maxIndex)
+            maxIndex = indices[element];
+
+    // make room for them in the cache, new entries are marked as never transformed
+    if (vertexBatchDraw.size() < maxIndex + 1)
+        vertexBatchDraw.resize(maxIndex + 1, 0);
+
+    // a new draw invalidates every entry, but when the counter wraps round we have to clear the tags
+    if (++drawCount == 0)
+        {
+        std::fill(vertexBatchDraw.begin(), vertexBatchDraw.end(), 0);
+        drawCount = 1;
+        }
+
+    // in deferred mode, copy each distinct vertex into a batch of its own, with indices to match
+    if (deferredPipeline)
+        {
+        BeginDeferredBatch(mode);
+        deferredBatch &batch = deferredBatches.back();
+        if (deferredRemap.size() < maxIndex + 1)
+            deferredRemap.resize(maxIndex + 1);
+        batch.indexCount = count;
+        deferredIndices.reserve(deferredIndices.size() + count);
+        unsigned int attributes = VertexAttributes();
+        vertexWithAttributes vertex;
+        for (int element = 0; element < count; element++)
+            {
+            unsigned int index = indices[element];
+            if (vertexBatchDraw[index] == drawCount)
+                vertexCacheHits++;
+            else
+                { // first use
+                vertexCacheMisses++;
+                FetchVertex(index, vertex, attributes);
+                deferredRemap[index] = batch.vertexCount++;
+                deferredVertices.push_back(vertex);
+                vertexBatchDraw[index] = drawCount;
+                } // first use
+            deferredIndices.push_back(deferredRemap[index]);
+            }
+        return;
+        }
+
+    screenVertexBatch batch = VertexBatch(maxIndex + 1, VertexAttributes());
+
+    // find each distinct index the first time it is used
+    vertexBatchMisses.clear();
+    for (int element = 0; element < count; element++)
+        {
+        unsigned int index = indices[element];
+        if (vertexBatchDraw[index] == drawCount)
+            {
+            vertexCacheHits++;
+            continue;
+            }
+        vertexCacheMisses++;
+        vertexBatchMisses.push_back(index);
+        vertexBatchDraw[index] = drawCount;
+        }
+
+    // transform stage: only the distinct indices are transformed
+    if (!vertexBatchMisses.empty())
+        TransformElements(0, &(vertexBatchMisses[0]), vertexBatchMisses.size(), batch);
+
+    // raster & fragment stages
+    RasteriseBatch(mode, batch, indices, count);
+    } // DrawElements()
+
+// goes back to the fixed-function shading after a draw call with shaders
+void FakeGL::UnbindShader()
+    { // UnbindShader()
+    boundShader = NULL;
+    deferredPipeline = boundDeferred;
+    } // UnbindShader()
+
+// fraction of DrawElements() vertices that were found already transformed
+float FakeGL::VertexCacheHitRate() const
+    { // VertexCacheHitRate()
+    unsigned long total = vertexCacheHits + vertexCacheMisses;
+    if (total == 0)
+        return 0.0;
+    return (float) vertexCacheHits / (float) total;
+    } // VertexCacheHitRate()
+
+// sets the post-transform cache statistics back to zero
+void FakeGL::ResetVertexCacheStatistics()
+    { // ResetVertexCacheStatistics()
+    vertexCacheHits = vertexCacheMisses = 0;
+    } // ResetVertexCacheStatistics()
+
 //-------------------------------------------------//
 //                                                 //
 // STATE VARIABLE ROUTINES                         //
@@ -493,6 +815,20 @@ void FakeGL::Disable(unsigned int property)
         case FAKEGL_PHONG_SHADING:
             phongShading = 0;
             break;
+        case FAKEGL_DEFERRED_PIPELINE:
+            // anything already recorded still has to be drawn
+            Flush();
+            deferredPipeline = 0;
+            break;
+        case FAKEGL_VISIBILITY_BUFFER:
+            visibilityShading = 0;
+            break;
+        case FAKEGL_CULL_FACE:
+            cullFace = 0;
+            break;
+        case FAKEGL_SCISSOR_TEST:
+            scissorTest = 0;
+            break;
         default:
             break;
         }
@@ -516,11 +852,63 @@ void FakeGL::Enable(unsigned int property)
         case FAKEGL_PHONG_SHADING:
             phongShading = 1;
             break;
+        case FAKEGL_DEFERRED_PIPELINE:
+            deferredPipeline = 1;
+            break;
+        case FAKEGL_VISIBILITY_BUFFER:
+            visibilityShading = 1;
+            break;
+        case FAKEGL_CULL_FACE:
+            cullFace = 1;
+            break;
+        case FAKEGL_SCISSOR_TEST:
+            scissorTest = 1;
+            break;
         default:
             break;
         }
     } // Enable()
 
+// sets which faces are culled when FAKEGL_CULL_FACE is enabled
+void FakeGL::CullFace(unsigned int mode)
+    { // CullFace()
+    // GL_INVALID_ENUM is generated if mode is not an accepted value
+    if ((mode != FAKEGL_FRONT) && (mode != FAKEGL_BACK) && (mode != FAKEGL_FRONT_AND_BACK)) return;
+    cullFaceMode = mode;
+    } // CullFace()
+
+// sets which winding in screen space faces the front
+void FakeGL::FrontFace(unsigned int mode)
+    { // FrontFace()
+    // GL_INVALID_ENUM is generated if mode is not an accepted value
+    if ((mode != FAKEGL_CW) && (mode != FAKEGL_CCW)) return;
+    frontFace = mode;
+    } // FrontFace()
+
+// trades accuracy for speed: FAKEGL_SHADING_PRECISION may be FAKEGL_FAST or FAKEGL_NICEST
+void FakeGL::Hint(unsigned int target, unsigned int mode)
+    { // Hint()
+    // GL_INVALID_ENUM is generated if target or mode is not an accepted value
+    if ((mode != FAKEGL_FAST) && (mode != FAKEGL_NICEST)) return;
+    if (target == FAKEGL_SHADING_PRECISION)
+        shadingPrecision = mode;
+    } // Hint()
+
+// sets the number of threads used by the pipeline, 1 runs everything on the calling thread
+void FakeGL::Threads(unsigned int threadCount)
+    { // Threads()
+    threadPool.Resize(threadCount);
+    } // Threads()
+
+// sets the raster statistics back to zero
+void FakeGL::ResetRasterStatistics()
+    { // ResetRasterStatistics()
+    blocksRejected = blocksCovered = blocksPartial = 0;
+    fragmentsShadingSkipped = 0;
+    trianglesFaceCulled = trianglesFrustumCulled = 0;
+    trianglesClipped = 0;
+    } // ResetRasterStatistics()
+
 //-------------------------------------------------//
 //                                                 //
 // LIGHTING STATE ROUTINES                         //
@@ -558,7 +946,170 @@ void FakeGL::Light(int parameterName, const float *parameterValues)
         specularLight[2] = parameterValues[2];
         specularLight[3] = parameterValues[3];
         }
+    SetupLightingConstants();
     } // Light()
+
+// works out the lighting constants for the current light & material
+void FakeGL::SetupLightingConstants()
+    { // SetupLightingConstants()
+    // light direction
+    Cartesian3 vl;
+    if (lightPosition.w != 0)
+        vl = lightPosition.Vector() / lightPosition.w;
+    else
+        vl = lightPosition.Vector();
+    lightConstants.lightDirection = vl / vl.length();
+    lightConstants.halfVector = (vl / 2.0) / (vl / 2.0).length();
+
+    for (unsigned int channel = 0; channel < 4; channel++)
+        {
+        lightConstants.ambientLight[channel] = ambientLight[channel];
+        lightConstants.diffuseLight[channel] = diffuseLight[channel];
+        lightConstants.specularLight[channel] = specularLight[channel];
+        }
+
+    // products for the current material
+    const materialRecord &material = materials[currentMaterial];
+    lightConstants.material = currentMaterial;
+    for (unsigned int channel = 0; channel < 4; channel++)
+        {
+        lightConstants.ambientProduct[channel] = ambientLight[channel] * material.ambient[channel];
+        lightConstants.diffuseProduct[channel] = diffuseLight[channel] * material.DiffuseColour()[channel];
+        lightConstants.specularProduct[channel] = specularLight[channel] * material.SpecularColour()[channel];
+        }
+    } // SetupLightingConstants()
+
+// finds or adds the current material in the material table, and makes it the one new vertices are given
+void FakeGL::SetCurrentMaterial()
+    { // SetCurrentMaterial()
+    materialDirty = 0;
+    materialRecord material;
+    for (unsigned int channel = 0; channel < 4; channel++)
+        {
+        material.ambient[channel] = ambientMat[channel];
+        material.diffuse[channel] = diffuseMat[channel];
+        material.specular[channel] = specularMat[channel];
+        material.emissive[channel] = emissiveMat[channel];
+        }
+    material.exponent = exponent;
+    material.specularPowers = NULL;
+
+    // a material already in the table keeps its ID, and a new one needs room
+    if ((materialIDs.count(material) == 0) && (materials.size() == FAKEGL_MAX_MATERIALS))
+        RestartMaterials();
+    currentMaterial = AddMaterial(material);
+
+    // its specular table is in use again, or made again if it was thrown away
+    materials[currentMaterial].specularPowers = SpecularTable(exponent);
+
+    // the products in the lighting constants are for the current material
+    SetupLightingConstants();
+    } // SetCurrentMaterial()
+
+// does the above if Material*() has changed the material since
+void FakeGL::ResolveMaterial()
+    { // ResolveMaterial()
+    if (materialDirty)
+        SetCurrentMaterial();
+    } // ResolveMaterial()
+
+// finds or adds a material in the material table, returning its ID
+unsigned short FakeGL::AddMaterial(const materialRecord &material)
+    { // AddMaterial()
+    std::map<materialRecord, unsigned short>::iterator found = materialIDs.find(material);
+    if (found == materialIDs.end())
+        {
+        found = materialIDs.insert(std::make_pair(material, (unsigned short) materials.size())).first;
+        materials.push_back(material);
+        }
+    return found->second;
+    } // AddMaterial()
+
+// empties the full material table, drawing what was recorded first and giving the vertices still waiting new IDs,
+// so that no ID ever stands for two materials at once
+void FakeGL::RestartMaterials()
+    { // RestartMaterials()
+    // a primitive still being recorded between Begin() & End() can't be drawn yet, so its vertices are taken out
+    std::vector<vertexWithAttributes> unfinished;
+    bool recording = deferredPipeline && !deferredBatches.empty() && (primitive == deferredBatches.back().primitive);
+    if (recording)
+        {
+        unfinished.assign(deferredVertices.begin() + deferredBatches.back().firstVertex, deferredVertices.end());
+        deferredVertices.resize(deferredBatches.back().firstVertex);
+        deferredBatches.pop_back();
+        }
+
+    // everything else recorded is drawn with the table as it is
+    Flush();
+
+    // the table starts again with the materials of the vertices left & the current material
+    std::vector<materialRecord> oldMaterials;
+    oldMaterials.swap(materials);
+    materialIDs.clear();
+    for (unsigned int vertex = 0; vertex < unfinished.size(); vertex++)
+        unfinished[vertex].material = AddMaterial(oldMaterials[unfinished[vertex].material]);
+    // in eager mode, the vertices of a primitive not yet complete wait in the queues
+    for (auto vertex = vertexQueue.begin(); vertex < vertexQueue.end(); vertex++)
+        vertex->material = AddMaterial(oldMaterials[vertex->material]);
+    for (auto vertex = rasterQueue.begin(); vertex < rasterQueue.end(); vertex++)
+        vertex->material = AddMaterial(oldMaterials[vertex->material]);
+    currentMaterial = AddMaterial(oldMaterials[currentMaterial]);
+    SetupLightingConstants();
+
+    // Flush() released their specular tables, but they are still needed
+    for (unsigned int material = 0; material < materials.size(); material++)
+        materials[material].specularPowers = SpecularTable(materials[material].exponent);
+
+    // the unfinished primitive goes back in a batch of its own, recorded with the new IDs
+    if (recording)
+        {
+        BeginDeferredBatch(primitive);
+        deferredVertices.insert(deferredVertices.end(), unfinished.begin(), unfinished.end());
+        deferredBatches.back().vertexCount = unfinished.size();
+        }
+    } // RestartMaterials()
+
+// finds or makes the table of cos^exponent for a material new vertices are given, and marks it in use until the next Flush()
+const float *FakeGL::SpecularTable(float exponent)
+    { // SpecularTable()
+    std::map<float, specularTable>::iterator found = specularTables.find(exponent);
+    if (found == specularTables.end())
+        { // new table
+        // make room by throwing away the least recently used table that nothing waiting to be drawn uses
+        if (specularTables.size() >= FAKEGL_MAX_SPECULAR_TABLES)
+            {
+            std::map<float, specularTable>::iterator oldest = specularTables.end();
+            for (auto table = specularTables.begin(); table != specularTables.end(); table++)
+                if ((table->second.lastUsed != flushCount) && ((oldest == specularTables.end()) || (table->second.lastUsed < oldest->second.lastUsed)))
+                    oldest = table;
+            // with every one in use, this material goes without, and fast shading falls back on FastPow()
+            if (oldest == specularTables.end())
+                return NULL;
+            // the materials that had it go without until they are made current again
+            const float *powers = oldest->second.powers.data();
+            for (unsigned int material = 0; material < materials.size(); material++)
+                if (materials[material].specularPowers == powers)
+                    materials[material].specularPowers = NULL;
+            specularTables.erase(oldest);
+            }
+
+        // tabulate cos^shininess the first time the shininess is used
+        found = specularTables.insert(std::make_pair(exponent, specularTable())).first;
+        std::vector<float> &table = found->second.powers;
+        table.resize(FAKEGL_SPECULAR_TABLE_SIZE + 1);
+        for (int sample = 0; sample <= FAKEGL_SPECULAR_TABLE_SIZE; sample++)
+            table[sample] = pow((float) sample / FAKEGL_SPECULAR_TABLE_SIZE, exponent);
+        } // new table
+    found->second.lastUsed = flushCount;
+    return found->second.powers.data();
+    } // SpecularTable()
+
+// called when nothing recorded is left to draw, so that only the current material's specular table is in use
+void FakeGL::ReleaseSpecularTables()
+    { // ReleaseSpecularTables()
+    flushCount++;
+    materials[currentMaterial].specularPowers = SpecularTable(materials[currentMaterial].exponent);
+    } // ReleaseSpecularTables()
 //-------------------------------------------------//
 //                                                 //
 // TEXTURE PROCESSING ROUTINES                     //
@@ -580,6 +1131,9 @@ void FakeGL::TexEnvMode(unsigned int textureMode)
 // sets the texture image that corresponds to a given ID
 void FakeGL::TexImage2D(const RGBAImage &textureImage)
     { // TexImage2D()
+    // recorded primitives must be drawn with the old texture
+    Flush();
+
     // resize image buffer,swapping height and width to match OpenGL output
     textureData.Resize(textureImage.height, textureImage.width);
 
@@ -599,17 +1153,26 @@ void FakeGL::TexImage2D(const RGBAImage &textureImage)
 // clears the frame buffer
 void FakeGL::Clear(unsigned int mask)
     { // Clear()
+    // recorded primitives must be drawn before they are cleared
+    Flush();
+
+    // like drawing, clearing is limited to the scissor box
+    rasterRegion region = DrawRegion();
+
     // set the frame buffer to be the desired colour stored in clearColour
     if(mask & FAKEGL_COLOR_BUFFER_BIT)
-        for(unsigned int row = 0; row < frameBuffer.height; row++)
-            for(unsigned int col = 0; col < frameBuffer.width; col++)
+        for(int row = region.minRow; row <= region.maxRow; row++)
+            for(int col = region.minCol; col <= region.maxCol; col++)
                 frameBuffer[row][col] = clearColour;
 
-    // set the depth buffer to be the desired colour stored in depth
+    // set the depth buffer to the clear depth, in bulk
     if(mask & FAKEGL_DEPTH_BUFFER_BIT)
-        for(unsigned int row = 0; row < depthBuffer.height; row++)
-            for(unsigned int col = 0; col < depthBuffer.width; col++)
-                depthBuffer[row][col] = depthColour;
+        {
+        if (scissorTest)
+            depthBuffer.Clear(clearDepth, region.minRow, region.maxRow, region.minCol, region.maxCol);
+        else
+            depthBuffer.Clear(clearDepth);
+        }
 
     } // Clear()
 
@@ -626,6 +1189,251 @@ void FakeGL::ClearColor(float red, float green, float blue, float alpha)
     clearColour = RGBAValue(clampedR * 255, clampedG * 255, clampedB * 255, clampedA * 255);
     } // ClearColor()
 
+//-------------------------------------------------//
+//                                                 //
+// ROUTINE TO FLUSH THE PIPELINE                   //
+//                                                 //
+//-------------------------------------------------//
+
+// flushes the pipeline
+// in deferred mode, this is where the recorded primitives are actually drawn
+void FakeGL::Flush()
+    { // Flush()
+    // the eager pipeline has nothing left to do
+    if (deferredBatches.empty())
+        {
+        ReleaseSpecularTables();
+        return;
+        }
+
+    // keep the current state so we can put it back afterwards
+    renderState currentState;
+    SaveState(currentState);
+
+    // transform stage: every recorded vertex, batch by batch, into only the parts its batch's state uses
+    // the other parts are sized for every vertex as soon as any batch uses them, so that they line up
+    deferredScreenVertices.resize(deferredVertices.size());
+    for (unsigned int batch = 0; batch < deferredBatches.size(); batch++)
+        { // per batch
+        deferredBatch &thisBatch = deferredBatches[batch];
+        if (thisBatch.vertexCount == 0)
+            continue;
+        RestoreState(thisBatch.state);
+        unsigned int attributes = VertexAttributes();
+        if ((attributes & FAKEGL_ATTRIBUTE_NORMAL) && (deferredScreenNormals.size() < deferredVertices.size()))
+            deferredScreenNormals.resize(deferredVertices.size());
+        if ((attributes & FAKEGL_ATTRIBUTE_TEXCOORD) && (deferredScreenTexCoords.size() < deferredVertices.size()))
+            deferredScreenTexCoords.resize(deferredVertices.size());
+        TransformBatch(&(deferredVertices[thisBatch.firstVertex]), DeferredScreenBatch(thisBatch.firstVertex, attributes), thisBatch.vertexCount);
+        } // per batch
+
+    // in visibility buffer mode, triangles only record which of them is nearest at each pixel
+    if (visibilityShading)
+        {
+        visibilitySample empty;
+        empty.triangle = FAKEGL_NO_TRIANGLE;
+        empty.alpha = empty.beta = empty.gamma = 0.0;
+        visibilityTriangles.clear();
+        visibilityClipVertices.clear();
+        visibilityBuffer.assign(frameBuffer.width * frameBuffer.height, empty);
+        }
+
+    // raster & fragment stages, in the order the batches were recorded
+    for (unsigned int batch = 0; batch < deferredBatches.size(); batch++)
+        { // per batch
+        deferredBatch &thisBatch = deferredBatches[batch];
+        if (thisBatch.vertexCount == 0)
+            continue;
+        RestoreState(thisBatch.state);
+
+        // number the batch's triangles & note their vertices, so the resolve pass can find them again
+        if (visibilityShading && (thisBatch.primitive == FAKEGL_TRIANGLES))
+            { // visibility buffer triangles
+            visibilityBase = visibilityTriangles.size();
+            unsigned int cornerCount = (thisBatch.indexCount != 0) ? thisBatch.indexCount : thisBatch.vertexCount;
+            visibilityTriangle triangle;
+            triangle.batch = batch;
+            triangle.clipped = false;
+            for (unsigned int corner = 0; corner + 2 < cornerCount; corner += 3)
+                { // per triangle
+                if (thisBatch.indexCount != 0)
+                    {
+                    triangle.vertex0 = thisBatch.firstVertex + deferredIndices[thisBatch.firstIndex + corner];
+                    triangle.vertex1 = thisBatch.firstVertex + deferredIndices[thisBatch.firstIndex + corner + 1];
+                    triangle.vertex2 = thisBatch.firstVertex + deferredIndices[thisBatch.firstIndex + corner + 2];
+                    }
+                else
+                    {
+                    triangle.vertex0 = thisBatch.firstVertex + corner;
+                    triangle.vertex1 = thisBatch.firstVertex + corner + 1;
+                    triangle.vertex2 = thisBatch.firstVertex + corner + 2;
+                    }
+                visibilityTriangles.push_back(triangle);
+                } // per triangle
+            } // visibility buffer triangles
+
+        screenVertexBatch screenVertices = DeferredScreenBatch(thisBatch.firstVertex, VertexAttributes());
+        if (thisBatch.indexCount != 0)
+            RasteriseBatch(thisBatch.primitive, screenVertices, &(deferredIndices[thisBatch.firstIndex]), thisBatch.indexCount);
+        else
+            RasteriseBatch(thisBatch.primitive, screenVertices, NULL, thisBatch.vertexCount);
+        visibilityBase = FAKEGL_NO_TRIANGLE;
+        } // per batch
+
+    // now shade each pixel the triangles left visible, exactly once
+    if (visibilityShading)
+        {
+        ResolveVisibility();
+        visibilityBuffer.clear();
+        }
+
+    // now empty out the recording, keeping the storage for the next frame
+    deferredBatches.clear();
+    deferredVertices.clear();
+    deferredIndices.clear();
+
+    // and put the state back
+    RestoreState(currentState);
+    ReleaseSpecularTables();
+    } // Flush()
+
+// shades every pixel of the visibility buffer that a triangle covers
+void FakeGL::ResolveVisibility()
+    { // ResolveVisibility()
+    // each pixel is shaded independently, so the rows are shared out over the thread pool
+    threadPool.ParallelFor(frameBuffer.height, [&](unsigned int row, unsigned int)
+        { // per row
+        // neighbouring pixels usually lie in the same triangle, so its shading setup is kept until that changes
+        shadingState state;
+        triangleShading shading;
+        shadeKernel shade = nullptr;
+        unsigned int shadingTriangle = FAKEGL_NO_TRIANGLE;
+        const visibilitySample *samples = &(visibilityBuffer[row * frameBuffer.width]);
+        for (int col = 0; col < frameBuffer.width; col++)
+            { // per pixel
+            const visibilitySample &sample = samples[col];
+            if (sample.triangle == FAKEGL_NO_TRIANGLE)
+                continue;
+
+            if (sample.triangle != shadingTriangle)
+                {
+                const visibilityTriangle &triangle = visibilityTriangles[sample.triangle];
+                ShadingState(deferredBatches[triangle.batch].state, state);
+                // the vertices are read where they are, in the batch's arrays or with the clipped pieces
+                screenVertexParts corners[3];
+                if (triangle.clipped)
+                    {
+                    corners[0] = visibilityClipVertices[triangle.vertex0];
+                    corners[1] = visibilityClipVertices[triangle.vertex1];
+                    corners[2] = visibilityClipVertices[triangle.vertex2];
+                    }
+                else
+                    {
+                    screenVertexBatch screenVertices = DeferredScreenBatch(0, 
+                        (state.lighting ? FAKEGL_ATTRIBUTE_NORMAL : 0) | (state.texture ? FAKEGL_ATTRIBUTE_TEXCOORD : 0));
+                    corners[0] = screenVertices.Parts(triangle.vertex0);
+                    corners[1] = screenVertices.Parts(triangle.vertex1);
+                    corners[2] = screenVertices.Parts(triangle.vertex2);
+                    }
+                SetupTriangleShading(state, corners[0], corners[1], corners[2], shading);
+                shade = shadeKernels[shading.kernel];
+                shadingTriangle = sample.triangle;
+                }
+
+            frameBuffer[row][col] = (this->*shade)(shading, sample.alpha, sample.beta, sample.gamma);
+            } // per pixel
+        }); // per row
+    } // ResolveVisibility()
+
+// copies the state used to draw primitives
+void FakeGL::SaveState(renderState &state)
+    { // SaveState()
+    state.modelView = modelViewStack.back();
+    state.projection = projectionStack.back();
+    state.xPixelOrigin = xPixelOrigin;
+    state.yPixelOrigin = yPixelOrigin;
+    state.viewPortSize = viewPortSize;
+    state.lighting = lighting;
+    state.texture = texture;
+    state.depthTest = depthTest;
+    state.phongShading = phongShading;
+    state.texMode = texMode;
+    state.cullFace = cullFace;
+    state.cullFaceMode = cullFaceMode;
+    state.frontFace = frontFace;
+    state.scissorTest = scissorTest;
+    state.shadingPrecision = shadingPrecision;
+    state.scissorX = scissorX;
+    state.scissorY = scissorY;
+    state.scissorWidth = scissorWidth;
+    state.scissorHeight = scissorHeight;
+    state.lightPosition = lightPosition;
+    for (unsigned int channel = 0; channel < 4; channel++)
+        {
+        state.ambientLight[channel] = ambientLight[channel];
+        state.diffuseLight[channel] = diffuseLight[channel];
+        state.specularLight[channel] = specularLight[channel];
+        }
+    state.lightConstants = lightConstants;
+    state.pointSize = pointSize;
+    state.lineWidth = lineWidth;
+    state.nearVal = nearVal;
+    state.farVal = farVal;
+    } // SaveState()
+
+// sets the state used to draw primitives
+void FakeGL::RestoreState(const renderState &state)
+    { // RestoreState()
+    modelViewStack.back() = state.modelView;
+    projectionStack.back() = state.projection;
+    xPixelOrigin = state.xPixelOrigin;
+    yPixelOrigin = state.yPixelOrigin;
+    viewPortSize = state.viewPortSize;
+    lighting = state.lighting;
+    texture = state.texture;
+    depthTest = state.depthTest;
+    phongShading = state.phongShading;
+    texMode = state.texMode;
+    cullFace = state.cullFace;
+    cullFaceMode = state.cullFaceMode;
+    frontFace = state.frontFace;
+    scissorTest = state.scissorTest;
+    shadingPrecision = state.shadingPrecision;
+    scissorX = state.scissorX;
+    scissorY = state.scissorY;
+    scissorWidth = state.scissorWidth;
+    scissorHeight = state.scissorHeight;
+    lightPosition = state.lightPosition;
+    for (unsigned int channel = 0; channel < 4; channel++)
+        {
+        ambientLight[channel] = state.ambientLight[channel];
+        diffuseLight[channel] = state.diffuseLight[channel];
+        specularLight[channel] = state.specularLight[channel];
+        }
+    lightConstants = state.lightConstants;
+    if (pointSize != state.pointSize)
+        {
+        pointSize = state.pointSize;
+        SetupPointSpans();
+        }
+    lineWidth = state.lineWidth;
+    nearVal = state.nearVal;
+    farVal = state.farVal;
+    } // RestoreState()
+
+// starts a new deferred batch with the current state
+void FakeGL::BeginDeferredBatch(unsigned int mode)
+    { // BeginDeferredBatch()
+    deferredBatch batch;
+    batch.primitive = mode;
+    batch.firstVertex = deferredVertices.size();
+    batch.vertexCount = 0;
+    batch.firstIndex = deferredIndices.size();
+    batch.indexCount = 0;
+    SaveState(batch.state);
+    deferredBatches.push_back(batch);
+    } // BeginDeferredBatch()
+
 //-------------------------------------------------//
 //                                                 //
 // MAJOR PROCESSING ROUTINES                       //
@@ -635,58 +1443,524 @@ void FakeGL::ClearColor(float red, float green, float blue, float alpha)
 // transform one vertex & shift to the raster queue
 void FakeGL::TransformVertex()
     { // TransformVertex()
-    // get the vertex at the front of the queue
-    vertexWithAttributes vertex = vertexQueue.front();
+    // create the screen vertex
+    screenVertexWithAttributes screenVertex;
+
+    // transform the vertex at the front of the queue
+    unsigned int attributes = VertexAttributes();
+    // the material ID is kept even without lighting, so that RestartMaterials() can renumber every queued vertex
+    screenVertex.material = vertexQueue.front().material;
+    TransformVertex(vertexQueue.front(), screenVertex, (attributes & FAKEGL_ATTRIBUTE_NORMAL) ? &screenVertex : NULL, 
+        (attributes & FAKEGL_ATTRIBUTE_TEXCOORD) ? &screenVertex : NULL);
+    if (UnitNormals())
+        screenVertex.normal = FastUnit(screenVertex.normal);
+    
+    // add to the screen vertex to raster queue
+    rasterQueue.push_back(screenVertex);
+
+    // now remove vertex from vertex queue
+    vertexQueue.pop_front();
 
-    //std::cout << "vertex ---------- " << std::endl;
+    } // TransformVertex()
 
+// transform a single vertex to screen space, leaving out the normal or texture coordinates if they are NULL
+void FakeGL::TransformVertex(const vertexWithAttributes &vertex, screenVertexCore &screenVertex, screenVertexNormal *normal, screenVertexTexCoord *texCoord)
+    { // TransformVertex()
     // convert to view space (model view)
     Homogeneous4 coordVCS = modelViewStack.back() * vertex.position;
-
-    //std::cout << coordVCS << std::endl;
     
     // convert to clipping space space (projection)
     Homogeneous4 coordCS = projectionStack.back() * coordVCS;
 
-    //std::cout << coordCS << std::endl;
+    // place it on screen
+    ProjectVertex(coordCS, coordVCS.z, screenVertex);
+
+    // the colour is always used, the rest only when the state needs them
+    screenVertex.colour = vertex.colour;
+
+    // lighting properties
+    if (normal != NULL)
+        {
+        normal->normal = (modelViewStack.back() * vertex.normal).Vector();
+        normal->material = vertex.material;
+        }
+
+    // texture properties
+    if (texCoord != NULL)
+        {
+        texCoord->u = vertex.u;
+        texCoord->v = vertex.v;
+        }
+    } // TransformVertex()
+
+// the attributes beyond position & colour the current state needs, as FAKEGL_ATTRIBUTE_* bits
+unsigned int FakeGL::VertexAttributes()
+    { // VertexAttributes()
+    // a draw call's own shader says what it needs
+    if (boundShader != NULL)
+        return boundAttributes;
+    return (lighting ? FAKEGL_ATTRIBUTE_NORMAL : 0) | (texture ? FAKEGL_ATTRIBUTE_TEXCOORD : 0);
+    } // VertexAttributes()
+
+// whether the transform stage leaves the normals at unit length, as fast fixed-function shading wants them
+bool FakeGL::UnitNormals()
+    { // UnitNormals()
+    return (boundShader == NULL) && lighting && (shadingPrecision == FAKEGL_FAST);
+    } // UnitNormals()
+
+// maps a clip space position to the screen, keeping the z in view space, and sets the clip codes
+void FakeGL::ProjectVertex(const Homogeneous4 &coordCS, float viewZ, screenVertexCore &screenVertex)
+    { // ProjectVertex()
+    screenVertex.clipPosition = coordCS;
+
+    // note which sides of the visible volume it is outside, while we still have w
+    // the viewport is a square in the middle of the frame buffer, and anything drawn beside it still shows,
+    // so the sides are those of the frame buffer (less half a pixel, for the rounding below) mapped back to clip space
+    screenVertex.clipCodes = 0;
+    if (coordCS.z < -coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_NEAR;
+    if (coordCS.z > coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_FAR;
+    if (viewPortSize > 0)
+        { // clip codes
+        float visible[4], guard[4];
+        FrameBounds(0.5, visible);
+        FrameBounds(FAKEGL_GUARD_BAND, guard);
+        if (coordCS.x < visible[0] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_LEFT;
+        if (coordCS.x > visible[1] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_RIGHT;
+        if (coordCS.y < visible[2] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_BOTTOM;
+        if (coordCS.y > visible[3] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_TOP;
+        if (coordCS.x < guard[0] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_GUARD_LEFT;
+        if (coordCS.x > guard[1] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_GUARD_RIGHT;
+        if (coordCS.y < guard[2] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_GUARD_BOTTOM;
+        if (coordCS.y > guard[3] * coordCS.w) screenVertex.clipCodes |= FAKEGL_CLIP_GUARD_TOP;
+        } // clip codes
     
     // convert to normalised device coordinates (divide by w)
     Cartesian3 coordNDS = coordCS.Point();
 
-    //std::cout << coordNDS << std::endl;
-
     // convert to device coordinates (screen space), keeping the z in view space
-    Cartesian3 coordDCS(
-        round(coordNDS.x * (viewPortSize / 2.0) + (viewPortSize / 2.0) + xPixelOrigin),
-        round(coordNDS.y * (viewPortSize / 2.0) + (viewPortSize / 2.0) + yPixelOrigin),
-        coordVCS.z);
+    // these keep their fractions: triangles snap them to a sub-pixel grid, and points to whole pixels
+    screenVertex.position = Cartesian3(
+        coordNDS.x * (viewPortSize / 2.0) + (viewPortSize / 2.0) + xPixelOrigin,
+        coordNDS.y * (viewPortSize / 2.0) + (viewPortSize / 2.0) + yPixelOrigin,
+        viewZ);
+    } // ProjectVertex()
+
+// the sides of the frame buffer, widened by a margin in pixels, mapped back to clip space as left, right, bottom, top
+void FakeGL::FrameBounds(float margin, float bounds[4])
+    { // FrameBounds()
+    float halfSize = viewPortSize / 2.0;
+    bounds[0] = (-margin - halfSize - xPixelOrigin) / halfSize;
+    bounds[1] = (frameBuffer.width - 1 + margin - halfSize - xPixelOrigin) / halfSize;
+    bounds[2] = (-margin - halfSize - yPixelOrigin) / halfSize;
+    bounds[3] = (frameBuffer.height - 1 + margin - halfSize - yPixelOrigin) / halfSize;
+    } // FrameBounds()
+
+// assembles a vertex with attributes from element index of the enabled arrays
+void FakeGL::FetchVertex(unsigned int index, vertexWithAttributes &vertex, unsigned int attributes)
+    { // FetchVertex()
+    // the position is always present, missing coordinates default as in glVertex*()
+    const float *position = vertexArray[index];
+    vertex.position = Homogeneous4(position[0], position[1], 
+        (vertexArray.size > 2) ? position[2] : 0.0, 
+        (vertexArray.size > 3) ? position[3] : 1.0);
+
+    // the other attributes fall back on the current state when their array is disabled
+    if (!(attributes & FAKEGL_ATTRIBUTE_NORMAL))
+        ; // not needed
+    else if (normalArray.enabled)
+        {
+        const float *normal = normalArray[index];
+        vertex.normal = Homogeneous4(normal[0], normal[1], normal[2], 0.0);
+        }
+    else
+        vertex.normal = Homogeneous4(attributeNormal.x, attributeNormal.y, attributeNormal.z, 0.0);
 
-    // create the screen vertex
-    screenVertexWithAttributes screenVertex;
+    if (colourArray.enabled)
+        {
+        // clamp & convert in the same way as Color3f()
+        const float *colour = colourArray[index];
+        float clampedR = (colour[0] < 0.0) ? 0.0 : (1.0 < colour[0]) ? 1.0 : colour[0];
+        float clampedG = (colour[1] < 0.0) ? 0.0 : (1.0 < colour[1]) ? 1.0 : colour[1];
+        float clampedB = (colour[2] < 0.0) ? 0.0 : (1.0 < colour[2]) ? 1.0 : colour[2];
+        vertex.colour = attributeColour;
+        vertex.colour.red = clampedR * 255;
+        vertex.colour.green = clampedG * 255;
+        vertex.colour.blue = clampedB * 255;
+        if (colourArray.size > 3)
+            {
+            float clampedA = (colour[3] < 0.0) ? 0.0 : (1.0 < colour[3]) ? 1.0 : colour[3];
+            vertex.colour.alpha = clampedA * 255;
+            }
+        }
+    else
+        vertex.colour = attributeColour;
 
-    // set its attributes with current state information
-    screenVertex.position = coordDCS;
-    screenVertex.normal = (modelViewStack.back() * vertex.normal).Vector();
+    if (!(attributes & FAKEGL_ATTRIBUTE_TEXCOORD))
+        ; // not needed
+    else if (texCoordArray.enabled)
+        {
+        const float *texCoord = texCoordArray[index];
+        vertex.u = texCoord[0];
+        vertex.v = texCoord[1];
+        }
+    else
+        {
+        vertex.u = attributeU;
+        vertex.v = attributeV;
+        }
 
-    // material properties
-    screenVertex.colour = vertex.colour;
-    screenVertex.ambient = vertex.ambient;
-    screenVertex.diffuse = vertex.specular;
-    screenVertex.specular = vertex.diffuse;
-    screenVertex.emissive = vertex.emissive;
-    screenVertex.exponent = vertex.exponent;
+    // materials are not part of the arrays, so use the current one
+    vertex.material = currentMaterial;
+    } // FetchVertex()
+
+// transforms count vertices into the parts a preallocated batch has, in chunks spread over the thread pool
+void FakeGL::TransformBatch(const vertexWithAttributes *vertices, const screenVertexBatch &screenVertices, unsigned int count)
+    { // TransformBatch()
+    // each chunk writes only its own slice of the output, so the order is the same however many threads run
+    bool unitNormals = (screenVertices.normals != NULL) && UnitNormals();
+    unsigned int chunks = (count + FAKEGL_TRANSFORM_CHUNK - 1) / FAKEGL_TRANSFORM_CHUNK;
+    threadPool.ParallelFor(chunks, [&](unsigned int chunk, unsigned int)
+        { // per chunk
+        unsigned int begin = chunk * FAKEGL_TRANSFORM_CHUNK;
+        unsigned int end = std::min(begin + FAKEGL_TRANSFORM_CHUNK, count);
+        Cartesian3 *normals[FAKEGL_TRANSFORM_CHUNK];
+        unsigned int normalCount = 0;
+        for (unsigned int vertex = begin; vertex < end; vertex++)
+            {
+            TransformVertex(vertices[vertex], screenVertices.cores[vertex], 
+                (screenVertices.normals != NULL) ? &(screenVertices.normals[vertex]) : NULL, 
+                (screenVertices.texCoords != NULL) ? &(screenVertices.texCoords[vertex]) : NULL);
+            if (unitNormals)
+                normals[normalCount++] = &(screenVertices.normals[vertex].normal);
+            }
+        // the whole chunk's normals at once, so FastNormalise() can take them four at a time
+        FastNormalise(normals, normalCount);
+        }); // per chunk
+    } // TransformBatch()
+
+// fetches & transforms count array elements into the parts a batch has, in chunks spread over the thread pool
+void FakeGL::TransformElements(int first, const unsigned int *elements, unsigned int count, const screenVertexBatch &batch)
+    { // TransformElements()
+    // the caller has already sized the batch, so each element has a slot of its own
+    unsigned int attributes = batch.Attributes();
+    bool unitNormals = (batch.normals != NULL) && UnitNormals();
+    unsigned int chunks = (count + FAKEGL_TRANSFORM_CHUNK - 1) / FAKEGL_TRANSFORM_CHUNK;
+    threadPool.ParallelFor(chunks, [&](unsigned int chunk, unsigned int)
+        { // per chunk
+        unsigned int begin = chunk * FAKEGL_TRANSFORM_CHUNK;
+        unsigned int end = std::min(begin + FAKEGL_TRANSFORM_CHUNK, count);
+        vertexWithAttributes vertex;
+        Cartesian3 *normals[FAKEGL_TRANSFORM_CHUNK];
+        unsigned int normalCount = 0;
+        for (unsigned int entry = begin; entry < end; entry++)
+            { // per element
+            unsigned int element = (elements != NULL) ? elements[entry] : first + entry;
+            unsigned int slot = (elements != NULL) ? element : entry;
+            FetchVertex(element, vertex, attributes);
+            TransformVertex(vertex, batch.cores[slot], 
+                (batch.normals != NULL) ? &(batch.normals[slot]) : NULL, 
+                (batch.texCoords != NULL) ? &(batch.texCoords[slot]) : NULL);
+            if (unitNormals)
+                normals[normalCount++] = &(batch.normals[slot].normal);
+            } // per element
+        // the whole chunk's normals at once, so FastNormalise() can take them four at a time
+        FastNormalise(normals, normalCount);
+        }); // per chunk
+    } // TransformElements()
+
+// makes room for count entries in vertexBatch, & the arrays of whichever other parts the attributes need
+// the arrays only grow, so that the storage is reused between draws
+screenVertexBatch FakeGL::VertexBatch(unsigned int count, unsigned int attributes)
+    { // VertexBatch()
+    screenVertexBatch batch;
+    if (vertexBatch.size() < count)
+        vertexBatch.resize(count);
+    batch.cores = &(vertexBatch[0]);
+    batch.normals = NULL;
+    batch.texCoords = NULL;
+    if (attributes & FAKEGL_ATTRIBUTE_NORMAL)
+        {
+        if (vertexBatchNormals.size() < count)
+            vertexBatchNormals.resize(count);
+        batch.normals = &(vertexBatchNormals[0]);
+        }
+    if (attributes & FAKEGL_ATTRIBUTE_TEXCOORD)
+        {
+        if (vertexBatchTexCoords.size() < count)
+            vertexBatchTexCoords.resize(count);
+        batch.texCoords = &(vertexBatchTexCoords[0]);
+        }
+    return batch;
+    } // VertexBatch()
+
+// the batch made up of the deferred screen vertices from first on, with the parts the attributes need
+// Flush() has already sized the arrays of the parts that any of its batches need
+screenVertexBatch FakeGL::DeferredScreenBatch(unsigned int first, unsigned int attributes)
+    { // DeferredScreenBatch()
+    screenVertexBatch batch;
+    batch.cores = &(deferredScreenVertices[first]);
+    batch.normals = (attributes & FAKEGL_ATTRIBUTE_NORMAL) ? &(deferredScreenNormals[first]) : NULL;
+    batch.texCoords = (attributes & FAKEGL_ATTRIBUTE_TEXCOORD) ? &(deferredScreenTexCoords[first]) : NULL;
+    return batch;
+    } // DeferredScreenBatch()
+
+// rasterises count vertices' worth of primitives from a batch of transformed vertices & processes their fragments
+// vertices are taken in order, or looked up through indices if they are given
+void FakeGL::RasteriseBatch(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, int count)
+    { // RasteriseBatch()
+    // any incomplete primitive at the end is ignored
+    unsigned int primitiveCount = count / PrimitiveSize(mode);
+
+    // the whole batch is shaded with the same state
+    ShadingState(rasterShading);
+
+    // with more than one thread, the work is split up by tiles of the frame buffer
+    if (threadPool.Size() > 1)
+        {
+        RasteriseBatchTiled(mode, batch, indices, primitiveCount);
+        return;
+        }
 
-    // texture properties
-    screenVertex.u = vertex.u;
-    screenVertex.v = vertex.v;
-    
-    // add to the screen vertex to raster queue
-    rasterQueue.push_back(screenVertex);
+    // points need no fragments, so a batch of them is just a loop over the points
+    rasterRegion drawable = DrawRegion();
+    if (mode == FAKEGL_POINTS)
+        {
+        for (unsigned int point = 0; point < primitiveCount; point++)
+            RasterisePoint(batch.cores[indices ? indices[point] : point], drawable);
+        return;
+        }
 
-    // now remove vertex from vertex queue
-    vertexQueue.pop_front();
+    // fragments are processed after each primitive so that the fragment queue stays small
+    for (unsigned int primitive = 0; primitive < primitiveCount; primitive++)
+        {
+        if ((mode == FAKEGL_TRIANGLES) && CullBatchTriangle(batch, indices, primitive))
+            continue;
+        RasteriseBatchPrimitive(mode, batch, indices, primitive, drawable, fragmentQueue);
+        while(!fragmentQueue.empty())
+            ProcessFragment();
+        }
+    } // RasteriseBatch()
+
+// rasterises the primitives in a batch with the thread pool, binning them by the tiles they touch
+// each tile belongs to a single thread, so the frame & depth buffers need no locking
+void FakeGL::RasteriseBatchTiled(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitiveCount)
+    { // RasteriseBatchTiled()
+    // work out the grid of tiles over the frame buffer
+    int tileCols = (frameBuffer.width + FAKEGL_TILE_SIZE - 1) / FAKEGL_TILE_SIZE;
+    int tileRows = (frameBuffer.height + FAKEGL_TILE_SIZE - 1) / FAKEGL_TILE_SIZE;
+    if ((tileCols <= 0) || (tileRows <= 0))
+        return;
+
+    // only the tiles overlapping what may be drawn get anything
+    rasterRegion drawable = DrawRegion();
+    if ((drawable.minRow > drawable.maxRow) || (drawable.minCol > drawable.maxCol))
+        return;
+
+    // empty the bins, keeping their storage
+    tileBins.resize(tileRows * tileCols);
+    for (unsigned int tile = 0; tile < tileBins.size(); tile++)
+        tileBins[tile].clear();
+
+    // points & lines are drawn as discs, so pad their bounding boxes accordingly
+    float padding = 1.0;
+    if (mode == FAKEGL_POINTS)
+        padding += pointSize / 2.0;
+    else if (mode == FAKEGL_LINES)
+        padding += lineWidth / 2.0;
+
+    // binning: add each primitive to every tile its bounding box overlaps, in primitive order
+    unsigned int primitiveSize = PrimitiveSize(mode);
+    for (unsigned int primitive = 0; primitive < primitiveCount; primitive++)
+        { // per primitive
+        // culled triangles never reach a bin
+        if ((mode == FAKEGL_TRIANGLES) && CullBatchTriangle(batch, indices, primitive))
+            continue;
+
+        // find the bounding box in pixels, which only needs the positions
+        const screenVertexCore &first = batch.cores[indices ? indices[primitive * primitiveSize] : primitive * primitiveSize];
+        float minX = first.position.x, maxX = first.position.x, minY = first.position.y, maxY = first.position.y;
+        unsigned int clipCodes = first.clipCodes;
+        for (unsigned int vertex = 1; vertex < primitiveSize; vertex++)
+            {
+            const screenVertexCore &other = batch.cores[indices ? indices[primitive * primitiveSize + vertex] : primitive * primitiveSize + vertex];
+            if (other.position.x < minX) minX = other.position.x;
+            if (other.position.x > maxX) maxX = other.position.x;
+            if (other.position.y < minY) minY = other.position.y;
+            if (other.position.y > maxY) maxY = other.position.y;
+            clipCodes |= other.clipCodes;
+            }
+        minX -= padding; maxX += padding;
+        minY -= padding; maxY += padding;
 
-    } // TransformVertex()
+        // a triangle still to be clipped may have vertices behind the eye, so its box means nothing yet:
+        // it goes to every tile instead, and each tile clips it for itself
+        if ((mode == FAKEGL_TRIANGLES) && (clipCodes & FAKEGL_CLIP_PLANES))
+            {
+            minX = minY = 0.0;
+            maxX = frameBuffer.width;
+            maxY = frameBuffer.height;
+            }
+
+        // skip anything entirely outside what may be drawn (this also catches NaNs)
+        if (!((maxX >= drawable.minCol) && (maxY >= drawable.minRow) && (minX < drawable.maxCol + 1) && (minY < drawable.maxRow + 1)))
+            continue;
+
+        // clamp to the drawable region before converting to tiles
+        int minTileCol = ((minX < drawable.minCol) ? drawable.minCol : (int) minX) / FAKEGL_TILE_SIZE;
+        int minTileRow = ((minY < drawable.minRow) ? drawable.minRow : (int) minY) / FAKEGL_TILE_SIZE;
+        int maxTileCol = ((maxX > drawable.maxCol) ? drawable.maxCol : (int) maxX) / FAKEGL_TILE_SIZE;
+        int maxTileRow = ((maxY > drawable.maxRow) ? drawable.maxRow : (int) maxY) / FAKEGL_TILE_SIZE;
+
+        for (int tileRow = minTileRow; tileRow <= maxTileRow; tileRow++)
+            for (int tileCol = minTileCol; tileCol <= maxTileCol; tileCol++)
+                tileBins[tileRow * tileCols + tileCol].push_back(primitive);
+        } // per primitive
+
+    // each thread gets its own fragment queue
+    threadFragments.resize(threadPool.Size());
+
+    // now rasterise & shade whole tiles in parallel
+    threadPool.ParallelFor(tileBins.size(), [&](unsigned int tile, unsigned int thread)
+        { // per tile
+        // the pixels belonging to this tile that may be drawn
+        rasterRegion region;
+        region.minRow = std::max((int) (tile / tileCols) * FAKEGL_TILE_SIZE, drawable.minRow);
+        region.minCol = std::max((int) (tile % tileCols) * FAKEGL_TILE_SIZE, drawable.minCol);
+        region.maxRow = std::min((int) (tile / tileCols) * FAKEGL_TILE_SIZE + FAKEGL_TILE_SIZE - 1, drawable.maxRow);
+        region.maxCol = std::min((int) (tile % tileCols) * FAKEGL_TILE_SIZE + FAKEGL_TILE_SIZE - 1, drawable.maxCol);
+
+        // the primitives are still in order, so each pixel sees the same fragments in the same order
+        std::deque<fragmentWithAttributes> &fragments = threadFragments[thread];
+        const std::vector<unsigned int> &bin = tileBins[tile];
+        for (unsigned int entry = 0; entry < bin.size(); entry++)
+            {
+            RasteriseBatchPrimitive(mode, batch, indices, bin[entry], region, fragments);
+            while (!fragments.empty())
+                {
+                ProcessFragment(fragments.front());
+                fragments.pop_front();
+                }
+            }
+        }); // per tile
+    } // RasteriseBatchTiled()
+
+// rasterises a single primitive of a batch, writing fragments inside the region to the queue
+// the rasteriser reads the parts of its vertices where they are, in the batch's arrays
+void FakeGL::RasteriseBatchPrimitive(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitive, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments)
+    { // RasteriseBatchPrimitive()
+    unsigned int primitiveSize = PrimitiveSize(mode);
+    unsigned int first = primitive * primitiveSize;
+    screenVertexParts vertices[3];
+    for (unsigned int vertex = 0; vertex < primitiveSize; vertex++)
+        vertices[vertex] = batch.Parts(indices ? indices[first + vertex] : first + vertex);
+
+    switch(mode)
+        {
+        case FAKEGL_POINTS:
+            RasterisePoint(*vertices[0].core, region);
+            break;
+
+        case FAKEGL_LINES:
+            RasteriseLineSegment(*vertices[0].core, *vertices[1].core, region, fragments);
+            break;
+
+        case FAKEGL_TRIANGLES:
+            { // triangles
+            // in the visibility buffer, the triangles of a batch are numbered on from visibilityBase
+            unsigned int triangleID = (visibilityBase == FAKEGL_NO_TRIANGLE) ? FAKEGL_NO_TRIANGLE : visibilityBase + primitive;
+            RasteriseTriangle(vertices[0], vertices[1], vertices[2], region, fragments, triangleID);
+            break;
+            } // triangles
+
+        default:
+            break;
+        }
+    } // RasteriseBatchPrimitive()
+
+// the number of vertices in a primitive
+unsigned int FakeGL::PrimitiveSize(unsigned int mode)
+    { // PrimitiveSize()
+    switch (mode)
+        {
+        case FAKEGL_LINES:
+            return 2;
+        case FAKEGL_TRIANGLES:
+            return 3;
+        default:
+            return 1;
+        }
+    } // PrimitiveSize()
+
+// true if a triangle is culled for its facing or for lying outside the visible volume, which is counted
+bool FakeGL::CullTriangle(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const screenVertexCore &vertex2)
+    { // CullTriangle()
+    // if all three vertices are outside the same side of the visible volume, so is all of the triangle
+    if ((vertex0.clipCodes & vertex1.clipCodes & vertex2.clipCodes) != 0)
+        {
+        trianglesFrustumCulled++;
+        return true;
+        }
+
+    // a triangle that needs clipping may have vertices behind the eye, where the screen positions
+    // say nothing about its facing, so its pieces are face culled after clipping instead
+    if (((vertex0.clipCodes | vertex1.clipCodes | vertex2.clipCodes) & FAKEGL_CLIP_PLANES) != 0)
+        {
+        trianglesClipped++;
+        return false;
+        }
+
+    if (FaceCulled(vertex0, vertex1, vertex2))
+        {
+        trianglesFaceCulled++;
+        return true;
+        }
+
+    return false;
+    } // CullTriangle()
+
+// true if face culling is on and a triangle faces the culled way on screen
+bool FakeGL::FaceCulled(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const screenVertexCore &vertex2)
+    { // FaceCulled()
+    if (!cullFace)
+        return false;
+
+    // twice the signed area in screen space, which is positive when the vertices run anticlockwise
+    float area = (vertex1.position.x - vertex0.position.x) * (vertex2.position.y - vertex0.position.y) 
+               - (vertex2.position.x - vertex0.position.x) * (vertex1.position.y - vertex0.position.y);
+    bool front = (frontFace == FAKEGL_CCW) ? (area > 0.0) : (area < 0.0);
+    return (cullFaceMode == FAKEGL_FRONT_AND_BACK) || ((cullFaceMode == FAKEGL_FRONT) == front);
+    } // FaceCulled()
+
+// the same for a triangle of a batch
+bool FakeGL::CullBatchTriangle(const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitive)
+    { // CullBatchTriangle()
+    unsigned int first = primitive * 3;
+    if (indices)
+        return CullTriangle(batch.cores[indices[first]], batch.cores[indices[first + 1]], batch.cores[indices[first + 2]]);
+    else
+        return CullTriangle(batch.cores[first], batch.cores[first + 1], batch.cores[first + 2]);
+    } // CullBatchTriangle()
+
+// the region that may be drawn: the whole frame buffer, cut down to the scissor box if the test is on
+// if nothing may be drawn, the region is empty, with its minima above its maxima
+rasterRegion FakeGL::DrawRegion()
+    { // DrawRegion()
+    rasterRegion region;
+    region.minRow = 0;
+    region.minCol = 0;
+    region.maxRow = frameBuffer.height - 1;
+    region.maxCol = frameBuffer.width - 1;
+
+    // rows count up from the bottom of the frame buffer, as the scissor box's y does
+    if (scissorTest)
+        {
+        region.minRow = std::max(region.minRow, scissorY);
+        region.minCol = std::max(region.minCol, scissorX);
+        region.maxRow = std::min(region.maxRow, scissorY + scissorHeight - 1);
+        region.maxCol = std::min(region.maxCol, scissorX + scissorWidth - 1);
+        }
+    return region;
+    } // DrawRegion()
 
 // rasterise a single primitive if there are enough vertices on the queue
 bool FakeGL::RasterisePrimitive()
@@ -702,7 +1976,7 @@ bool FakeGL::RasterisePrimitive()
             if(rasterQueue.size() < 1)
                 return false;            
             // rasterise it
-            RasterisePoint(*rasterQueue.begin());            
+            RasterisePoint(*rasterQueue.begin(), DrawRegion());            
             // remove it
             rasterQueue.pop_front();            
             return true;
@@ -712,7 +1986,7 @@ bool FakeGL::RasterisePrimitive()
             if(rasterQueue.size() < 2)
                 return false;            
             // rasterise them
-            RasteriseLineSegment(*rasterQueue.begin(), *(rasterQueue.begin() + 1));            
+            RasteriseLineSegment(*rasterQueue.begin(), *(rasterQueue.begin() + 1), DrawRegion(), fragmentQueue);            
             // remove them
             rasterQueue.erase(rasterQueue.begin(), rasterQueue.begin() + 2);     
             return true;
@@ -721,8 +1995,9 @@ bool FakeGL::RasterisePrimitive()
             // not enough vertices for the primitive 
             if(rasterQueue.size() < 3)
                 return false;            
-            // rasterise them
-            RasteriseTriangle(*rasterQueue.begin(), *(rasterQueue.begin() + 1), *(rasterQueue.begin() + 2));            
+            // rasterise them, unless they are culled
+            if (!CullTriangle(*rasterQueue.begin(), *(rasterQueue.begin() + 1), *(rasterQueue.begin() + 2)))
+                RasteriseTriangle(*rasterQueue.begin(), *(rasterQueue.begin() + 1), *(rasterQueue.begin() + 2), DrawRegion(), fragmentQueue, FAKEGL_NO_TRIANGLE);
             // remove them
             rasterQueue.erase(rasterQueue.begin(), rasterQueue.begin() + 3);            
             return true;
@@ -732,320 +2007,626 @@ bool FakeGL::RasterisePrimitive()
         }
     } // RasterisePrimitive()
 
-// rasterises a single point
-void FakeGL::RasterisePoint(screenVertexWithAttributes &vertex0)
+// rasterises a single point, writing the pixels inside the region
+// nothing varies across a point, so it writes its spans straight to the frame buffer instead of queuing fragments
+// every caller has processed the fragments of earlier primitives by now, so the order of writes is unchanged
+void FakeGL::RasterisePoint(const screenVertexCore &vertex0, const rasterRegion &region)
     { // RasterisePoint()
-    // create a bounding box for the point
-    float minX = vertex0.position.x - (pointSize / 2.0), maxX = vertex0.position.x + (pointSize / 2.0); 
-    float minY = vertex0.position.y - (pointSize / 2.0), maxY = vertex0.position.y + (pointSize / 2.0);
-
-    // create a fragment for reuse
-    fragmentWithAttributes rasterFragment;
-
-    // loop over all fragments within the bounding box
-    for (rasterFragment.row = minY; rasterFragment.row <= maxY; rasterFragment.row++)
+    // the bottom left of the point's box, placed so that the middle of the box is nearest the vertex
+    float originX = round(vertex0.position.x - (pointSize - 1) / 2.0);
+    float originY = round(vertex0.position.y - (pointSize - 1) / 2.0);
+
+    // give up on points entirely outside the region (this also catches NaNs)
+    if (!((originX + pointSize > region.minCol) && (originY + pointSize > region.minRow) && (originX <= region.maxCol) && (originY <= region.maxRow)))
+        return;
+
+    // the depth, as for triangles & lines, and clipped the same way
+    float depth = (-vertex0.position.z - nearVal) / (farVal - nearVal);
+    if (depth > 1 || depth < 0)
+        return;
+
+    // now the box is known to be near the region, so it converts to int safely
+    int originRow = originY, originCol = originX;
+    int firstRow = std::max(originRow, region.minRow);
+    int lastRow = std::min(originRow + (int) pointSize - 1, region.maxRow);
+
+    // write each row's span, clipped to the region
+    for (int row = firstRow; row <= lastRow; row++)
         { // per row
-        // clip fragment if row values outside frame buffer
-        if (rasterFragment.row < 0) continue;
-        if (rasterFragment.row >= frameBuffer.height) continue;
-        for (rasterFragment.col = minX; rasterFragment.col <= maxX; rasterFragment.col++)
-            { // per pixel
-            // clip fragment if col values outside frame buffer
-            if (rasterFragment.col < 0) continue;
-            if (rasterFragment.col >= frameBuffer.width) continue;
-
-            // fragment distance to vertex centre
-            Cartesian3 frag2Vertex(vertex0.position.x - rasterFragment.col, vertex0.position.y - rasterFragment.row , 0.0);
-
-            // if pixel centre is not within pointsize (radius) then skip
-            if (frag2Vertex.dot(frag2Vertex) >= pointSize * pointSize)
-                continue;
-            
-            // otherwise we set its colour to the vertex's 
-            rasterFragment.colour = vertex0.colour;            
-
-            // we set the depth (ranging between 0 and 1 using near and far from projection)
-            rasterFragment.depth = vertex0.position.z;  
-
-            // then we add the fragment to the queue
-            fragmentQueue.push_back(rasterFragment);
-            } // per pixel
+        const pointSpan &span = pointSpans[row - originRow];
+        WriteSpan(row, std::max(originCol + span.firstCol, region.minCol), std::min(originCol + span.lastCol, region.maxCol), vertex0.colour, depth);
         } // per row
     } // RasterisePoint()
 
-// rasterises a single line segment
-void FakeGL::RasteriseLineSegment(screenVertexWithAttributes &vertex0, screenVertexWithAttributes &vertex1)
-    { // RasteriseLineSegment()
-
-    // create a raster fragment
-    screenVertexWithAttributes interpolatedVertex;
+// works out the spans of a point of the current size
+// the point is a disc of diameter pointSize around the middle of its box, and covers the pixels whose centres
+// are inside it: squares up to 3 pixels, and rounder after that
+void FakeGL::SetupPointSpans()
+    { // SetupPointSpans()
+    int size = pointSize;
+    float middle = (size - 1) / 2.0;
+    float radiusSquared = (size / 2.0) * (size / 2.0);
+
+    pointSpans.resize(size);
+    for (int row = 0; row < size; row++)
+        { // per row
+        // how far the disc reaches either side of the middle on this row
+        float reach = sqrt(radiusSquared - (row - middle) * (row - middle));
+        pointSpans[row].firstCol = (int) ceil(middle - reach);
+        pointSpans[row].lastCol = (int) floor(middle + reach);
+        } // per row
+    } // SetupPointSpans()
 
-    // keep a copy of point size
-    float pSize = pointSize;
-    // cheat and set point size to linewidth
-    PointSize(lineWidth / 2.0);
+// rasterises a single line segment, writing fragments inside the region to the queue
+// this is a DDA along the major axis, with a span of lineWidth pixels across it at each step,
+// so every pixel is emitted once, and the attributes are stepped along with it
+void FakeGL::RasteriseLineSegment(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments)
+    { // RasteriseLineSegment()
+    // work along whichever axis the line is longer in, from the lower end
+    bool xMajor = fabs(vertex1.position.x - vertex0.position.x) >= fabs(vertex1.position.y - vertex0.position.y);
+    const screenVertexCore &start = ((xMajor ? vertex1.position.x < vertex0.position.x : vertex1.position.y < vertex0.position.y) ? vertex1 : vertex0);
+    const screenVertexCore &end = (&start == &vertex0) ? vertex1 : vertex0;
+
+    // like points, lines run between whole pixels
+    float startMajor = round(xMajor ? start.position.x : start.position.y), endMajor = round(xMajor ? end.position.x : end.position.y);
+    float startMinor = round(xMajor ? start.position.y : start.position.x), endMinor = round(xMajor ? end.position.y : end.position.x);
+
+    // the region in the same terms
+    int regionMinMajor = xMajor ? region.minCol : region.minRow, regionMaxMajor = xMajor ? region.maxCol : region.maxRow;
+    int regionMinMinor = xMajor ? region.minRow : region.minCol, regionMaxMinor = xMajor ? region.maxRow : region.maxCol;
+
+    // give up on lines entirely outside the region along the major axis (this also catches NaNs)
+    if (!((endMajor >= regionMinMajor) && (startMajor <= regionMaxMajor)))
+        return;
+
+    // the pixels along the major axis that are inside the region, compared as floats before converting
+    int firstMajor = (startMajor > regionMinMajor) ? (int) startMajor : regionMinMajor;
+    int lastMajor = (endMajor < regionMaxMajor) ? (int) endMajor : regionMaxMajor;
+
+    // the change in each attribute per pixel along the major axis
+    float length = endMajor - startMajor;
+    float perPixel = (length > 0.0) ? 1.0 / length : 0.0;
+    float minorStep = (endMinor - startMinor) * perPixel;
+    float zStep = (end.position.z - start.position.z) * perPixel;
+    float redStep = ((float) end.colour.red - (float) start.colour.red) * perPixel;
+    float greenStep = ((float) end.colour.green - (float) start.colour.green) * perPixel;
+    float blueStep = ((float) end.colour.blue - (float) start.colour.blue) * perPixel;
+    float alphaStep = ((float) end.colour.alpha - (float) start.colour.alpha) * perPixel;
+
+    // and their values at the first pixel inside the region
+    float skipped = firstMajor - startMajor;
+    float minor = startMinor + skipped * minorStep;
+    float z = start.position.z + skipped * zStep;
+    float red = start.colour.red + skipped * redStep;
+    float green = start.colour.green + skipped * greenStep;
+    float blue = start.colour.blue + skipped * blueStep;
+    float alpha = start.colour.alpha + skipped * alphaStep;
+
+    // the span across the line, placed so that it is centred on the line for odd widths
+    int width = lineWidth;
+    int spanOffset = -(width - 1) / 2;
+
+    // the depth range, as for triangles
+    float depthRange = farVal - nearVal;
+
+    // create a fragment for reuse, which is depth tested after the rasteriser
+    fragmentWithAttributes rasterFragment;
+    rasterFragment.depthTested = false;
+
+    for (int major = firstMajor; major <= lastMajor; major++, 
+        minor += minorStep, z += zStep, red += redStep, green += greenStep, blue += blueStep, alpha += alphaStep)
+        { // per step
+        // make the fragment range between 0 and 1 using near and far from projection, and clip it
+        rasterFragment.depth = (-z - nearVal) / depthRange;
+        if (rasterFragment.depth > 1 || rasterFragment.depth < 0)
+            continue;
+        rasterFragment.colour = RGBAValue(red, green, blue, alpha);
+
+        // the span, clipped to the region, once we know the conversion to int is safe
+        if ((minor + width < regionMinMinor) || (minor - width > regionMaxMinor))
+            continue;
+        int firstMinor = (int) floor(minor + 0.5) + spanOffset;
+        int lastMinor = std::min(firstMinor + width - 1, regionMaxMinor);
+        firstMinor = std::max(firstMinor, regionMinMinor);
+
+        for (int across = firstMinor; across <= lastMinor; across++)
+            { // per pixel
+            rasterFragment.row = xMajor ? across : major;
+            rasterFragment.col = xMajor ? major : across;
+            fragments.push_back(rasterFragment);
+            } // per pixel
+        } // per step
+    } // RasteriseLineSegment()
 
-    // the max number of pixels along either width or height
-    float step = (frameBuffer.height < frameBuffer.width) ? frameBuffer.width : frameBuffer.height;
-    // iterate over the parameterised line between v0 and v1 using t (step size of 0.0015)
-    for(float t = 0.0; t <= 1.0; t += 1 / (2 * step))
+// rasterises a single triangle, writing fragments inside the region to the queue
+void FakeGL::RasteriseTriangle(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID)
+    { // RasteriseTriangle()
+    // triangles crossing the near or far plane or leaving the guard band are clipped first
+    // the pieces come back here with those clip codes cleared, so nothing is clipped twice
+    if (((vertex0.core->clipCodes | vertex1.core->clipCodes | vertex2.core->clipCodes) & FAKEGL_CLIP_PLANES) != 0)
         {
-        // interpolate the position of the point
-        interpolatedVertex.position = t*vertex1.position + (1-t)*vertex0.position;
-        // interpolate the colour value
-        interpolatedVertex.colour = t*vertex1.colour + (1-t)*vertex0.colour;
-
-        // call the rasterise point method for the interpolated vertex
-        RasterisePoint(interpolatedVertex);
+        ClipTriangle(vertex0, vertex1, vertex2, region, fragments, triangleID);
+        return;
         }
 
-    // set point size to original value
-    pointSize = pSize;
-    } // RasteriseLineSegment()
+    // the rest is done by the kernel for the state, so that none of it is tested per pixel,
+    // or for the draw call's own shader, which is never drawn into the visibility buffer
+    if (boundShader != NULL)
+        {
+        (this->*boundKernels[depthTest ? 1 : 0])(vertex0, vertex1, vertex2, region, fragments, triangleID);
+        return;
+        }
+    unsigned int kernel = KernelFlags(lighting, phongShading, texture, texMode, depthTest);
+    if (triangleID != FAKEGL_NO_TRIANGLE)
+        kernel |= FAKEGL_KERNEL_VISIBILITY;
+    (this->*rasterKernels[kernel])(vertex0, vertex1, vertex2, region, fragments, triangleID);
+    } // RasteriseTriangle()
 
-// rasterises a single triangle
-void FakeGL::RasteriseTriangle(screenVertexWithAttributes &vertex0, screenVertexWithAttributes &vertex1, screenVertexWithAttributes &vertex2)
-    { // RasteriseTriangle()
-    // compute a bounding box that starts inverted to frame size
-    // clipping will happen in the raster loop proper
-    float minX = frameBuffer.width, maxX = 0.0;
-    float minY = frameBuffer.height, maxY = 0.0;
-    
-    // test against all vertices
-    if (vertex0.position.x < minX) minX = vertex0.position.x;
-    if (vertex0.position.x > maxX) maxX = vertex0.position.x;
-    if (vertex0.position.y < minY) minY = vertex0.position.y;
-    if (vertex0.position.y > maxY) maxY = vertex0.position.y;
-    
-    if (vertex1.position.x < minX) minX = vertex1.position.x;
-    if (vertex1.position.x > maxX) maxX = vertex1.position.x;
-    if (vertex1.position.y < minY) minY = vertex1.position.y;
-    if (vertex1.position.y > maxY) maxY = vertex1.position.y;
-    
-    if (vertex2.position.x < minX) minX = vertex2.position.x;
-    if (vertex2.position.x > maxX) maxX = vertex2.position.x;
-    if (vertex2.position.y < minY) minY = vertex2.position.y;
-    if (vertex2.position.y > maxY) maxY = vertex2.position.y;
-
-    // now for each side of the triangle, compute the line vectors
-    Cartesian3 vector01 = vertex1.position - vertex0.position;
-    Cartesian3 vector12 = vertex2.position - vertex1.position;
-    Cartesian3 vector20 = vertex0.position - vertex2.position;
-
-    // now compute the line normal vectors
-    Cartesian3 normal01(-vector01.y, vector01.x, 0.0);  
-    Cartesian3 normal12(-vector12.y, vector12.x, 0.0);  
-    Cartesian3 normal20(-vector20.y, vector20.x, 0.0);  
-
-    // we don't need to normalise them, because the square roots will cancel out in the barycentric coordinates
-    float lineConstant01 = normal01.dot(vertex0.position);
-    float lineConstant12 = normal12.dot(vertex1.position);
-    float lineConstant20 = normal20.dot(vertex2.position);
-
-    // and compute the distance of each vertex from the opposing side
-    float distance0 = normal12.dot(vertex0.position) - lineConstant12;
-    float distance1 = normal20.dot(vertex1.position) - lineConstant20;
-    float distance2 = normal01.dot(vertex2.position) - lineConstant01;
-
-    // if any of these are zero, we will have a divide by zero error
-    // but notice that if they are zero, the vertices are collinear in projection and the triangle is edge on
-    // we can render that as a line, but the better solution is to render nothing.  In a surface, the adjacent
-    // triangles will eventually take care of it
-    if ((distance0 == 0) || (distance1 == 0) || (distance2 == 0))
-        return; 
-
-    // create a fragment for reuse
-    fragmentWithAttributes rasterFragment;
+// clips a triangle against the planes its vertices lie outside in clip space, and rasterises the pieces
+// given a triangle ID, each piece goes into the visibility buffer as a triangle of its own, with its own
+// vertices, as the barycentric coordinates the buffer keeps are those of the piece rather than of the triangle
+void FakeGL::ClipTriangle(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID)
+    { // ClipTriangle()
+    // only the planes some vertex lies outside can cut the triangle
+    unsigned int planes = (vertex0.core->clipCodes | vertex1.core->clipCodes | vertex2.core->clipCodes) & FAKEGL_CLIP_PLANES;
+
+    float guard[4];
+    FrameBounds(FAKEGL_GUARD_BAND, guard);
+
+    // only the attributes the state uses were transformed, so only those are interpolated
+    unsigned int attributes = VertexAttributes();
+    bool unitNormals = UnitNormals();
+
+    // distance of a clip space position inside a plane, negative exactly when ProjectVertex() sets its clip code
+    auto distance = [&](const Homogeneous4 &coordCS, unsigned int plane)
+        { // distance()
+        switch (plane)
+            {
+            case FAKEGL_CLIP_NEAR:          return coordCS.z + coordCS.w;
+            case FAKEGL_CLIP_FAR:           return coordCS.w - coordCS.z;
+            case FAKEGL_CLIP_GUARD_LEFT:    return coordCS.x - guard[0] * coordCS.w;
+            case FAKEGL_CLIP_GUARD_RIGHT:   return guard[1] * coordCS.w - coordCS.x;
+            case FAKEGL_CLIP_GUARD_BOTTOM:  return coordCS.y - guard[2] * coordCS.w;
+            default:                        return guard[3] * coordCS.w - coordCS.y;
+            }
+        }; // distance()
+
+    // the vertex part of the way from one inside a plane to one outside it
+    // attributes are linear in clip space, and so is the view space z the depth is computed from
+    auto intersect = [&](const screenVertexWithAttributes &inside, const screenVertexWithAttributes &outside, float t, screenVertexWithAttributes &result)
+        { // intersect()
+        // a material ID can't be interpolated, so the inside vertex's is kept
+        result = inside;
+        result.colour = (1.0 - t) * inside.colour + t * outside.colour;
+        if (attributes & FAKEGL_ATTRIBUTE_NORMAL)
+            {
+            result.normal = inside.normal + (outside.normal - inside.normal) * t;
+            if (unitNormals)
+                result.normal = FastUnit(result.normal);
+            }
+        if (attributes & FAKEGL_ATTRIBUTE_TEXCOORD)
+            {
+            result.u = inside.u + (outside.u - inside.u) * t;
+            result.v = inside.v + (outside.v - inside.v) * t;
+            }
+        ProjectVertex(inside.clipPosition + (outside.clipPosition - inside.clipPosition) * t, 
+            inside.position.z + (outside.position.z - inside.position.z) * t, result);
+        }; // intersect()
+
+    // Sutherland-Hodgman: clip the polygon against one plane at a time, which adds at most a vertex each
+    // the new vertices are made whole, so the corners are put together from their parts first
+    screenVertexWithAttributes polygons[2][9];
+    vertex0.Gather(polygons[0][0]);
+    vertex1.Gather(polygons[0][1]);
+    vertex2.Gather(polygons[0][2]);
+    unsigned int count = 3, current = 0;
+
+    for (unsigned int plane = FAKEGL_CLIP_NEAR; plane <= FAKEGL_CLIP_GUARD_TOP; plane <<= 1)
+        { // per plane
+        if (!(planes & plane))
+            continue;
+
+        const screenVertexWithAttributes *input = polygons[current];
+        screenVertexWithAttributes *output = polygons[1 - current];
+        unsigned int outputCount = 0;
+        for (unsigned int vertex = 0; vertex < count; vertex++)
+            { // per edge
+            const screenVertexWithAttributes &from = input[vertex];
+            const screenVertexWithAttributes &to = input[(vertex + 1) % count];
+            float fromDistance = distance(from.clipPosition, plane);
+            float toDistance = distance(to.clipPosition, plane);
+            bool fromInside = fromDistance >= 0.0, toInside = toDistance >= 0.0;
+
+            if (fromInside)
+                output[outputCount++] = from;
+
+            // where the edge crosses, always interpolate from the inside end, so that
+            // triangles sharing the edge get exactly the same new vertex
+            if (fromInside && !toInside)
+                intersect(from, to, fromDistance / (fromDistance - toDistance), output[outputCount++]);
+            else if (!fromInside && toInside)
+                intersect(to, from, toDistance / (toDistance - fromDistance), output[outputCount++]);
+            } // per edge
+
+        count = outputCount;
+        current = 1 - current;
+        if (count < 3)
+            return;
+        } // per plane
+
+    // the new vertices lie on the planes, so rounding must not send them round again
+    screenVertexWithAttributes *polygon = polygons[current];
+    for (unsigned int vertex = 0; vertex < count; vertex++)
+        polygon[vertex].clipCodes &= ~FAKEGL_CLIP_PLANES;
+
+    // and the polygon is convex, so it can be drawn as a fan, culling pieces now that their facing is known
+    for (unsigned int vertex = 1; vertex + 1 < count; vertex++)
+        { // per piece
+        if (FaceCulled(polygon[0], polygon[vertex], polygon[vertex + 1]))
+            continue;
+
+        // the tiles clip a triangle for themselves, so each tile's pieces are numbered separately
+        unsigned int pieceID = FAKEGL_NO_TRIANGLE;
+        if (triangleID != FAKEGL_NO_TRIANGLE)
+            { // visibility buffer piece
+            std::lock_guard<std::mutex> lock(visibilityMutex);
+            visibilityTriangle piece;
+            piece.batch = visibilityTriangles[triangleID].batch;
+            piece.clipped = true;
+            piece.vertex0 = visibilityClipVertices.size();
+            piece.vertex1 = piece.vertex0 + 1;
+            piece.vertex2 = piece.vertex0 + 2;
+            visibilityClipVertices.push_back(polygon[0]);
+            visibilityClipVertices.push_back(polygon[vertex]);
+            visibilityClipVertices.push_back(polygon[vertex + 1]);
+            pieceID = visibilityTriangles.size();
+            visibilityTriangles.push_back(piece);
+            } // visibility buffer piece
+
+        RasteriseTriangle(polygon[0], polygon[vertex], polygon[vertex + 1], region, fragments, pieceID);
+        } // per piece
+    } // ClipTriangle()
+
+// works out the per-triangle part of shading under the given state
+void FakeGL::ShadingState(shadingState &state)
+    { // ShadingState()
+    state.lighting = lighting;
+    state.texture = texture;
+    state.phongShading = phongShading;
+    state.texMode = texMode;
+    state.shadingPrecision = shadingPrecision;
+    state.lightConstants = &lightConstants;
+    } // ShadingState()
+
+void FakeGL::ShadingState(const renderState &recorded, shadingState &state)
+    { // ShadingState()
+    state.lighting = recorded.lighting;
+    state.texture = recorded.texture;
+    state.phongShading = recorded.phongShading;
+    state.texMode = recorded.texMode;
+    state.shadingPrecision = recorded.shadingPrecision;
+    state.lightConstants = &recorded.lightConstants;
+    } // ShadingState()
+
+void FakeGL::SetupTriangleShading(const shadingState &state, const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, triangleShading &shading)
+    { // SetupTriangleShading()
+    // keep the state the fragments are shaded with
+    shading.kernel = KernelFlags(state.lighting, state.phongShading, state.texture, state.texMode, false);
+    shading.shadingPrecision = state.shadingPrecision;
+    shading.lightConstants = state.lightConstants;
+    shading.vertex0 = vertex0;
+    shading.vertex1 = vertex1;
+    shading.vertex2 = vertex2;
+
+    // the per-triangle values are worked out in place
+    Cartesian3 &normal0 = shading.normal0, &normal1 = shading.normal1, &normal2 = shading.normal2;
+    float *v0I = shading.v0I, *v1I = shading.v1I, *v2I = shading.v2I;
+    const lightingConstants &light = *state.lightConstants;
+
+    // with one colour over the triangle, it needn't be interpolated
+    const RGBAValue &colour0 = vertex0.core->colour, &colour1 = vertex1.core->colour, &colour2 = vertex2.core->colour;
+    shading.flatColour = 
+        colour0.red == colour1.red && colour0.green == colour1.green && colour0.blue == colour1.blue && colour0.alpha == colour1.alpha &&
+        colour0.red == colour2.red && colour0.green == colour2.green && colour0.blue == colour2.blue && colour0.alpha == colour2.alpha;
+
+    // the rest is only for lighting, and without it the vertices carry no normals or materials
+    shading.flatMaterial = 0;
+    if (!state.lighting)
+        return;
+    const screenVertexNormal &lit0 = *vertex0.normal, &lit1 = *vertex1.normal, &lit2 = *vertex2.normal;
 
     // get the normals of each vertex and normalise to accomodate for scaling
-    Cartesian3 normal0 = vertex0.normal.unit();
-    Cartesian3 normal1 = vertex1.normal.unit();
-    Cartesian3 normal2 = vertex2.normal.unit();
-
-    // light direction
-    Cartesian3 vl;
-    if (lightPosition.w != 0)
-        vl = lightPosition.Vector() / lightPosition.w;
+    // (in fast mode the transform stage has already done so, a batch at a time: see UnitNormals())
+    bool fast = (state.shadingPrecision == FAKEGL_FAST);
+    if (fast)
+        {
+        normal0 = lit0.normal;
+        normal1 = lit1.normal;
+        normal2 = lit2.normal;
+        }
     else
-        vl = lightPosition.Vector();
-
-    // compute the light intensity at each vertex
-    float v0I[4], v1I[4], v2I[4] = {0.0, 0.0, 0.0, 0.0};
-    // only bother computing the light intensity at each vertex when lighting is enabled and we don't want phong shading
-    if (lighting && !phongShading)
-    {
-        // vertex 0
-        // cosine may be negative which causes underflow as we store values as unsigned int (-1 = 2^32)
-        float cosDif = normal0.dot(vl) / vl.length();
-        cosDif = (cosDif > 0) ? cosDif : 0;
-        float cosSpec = normal0.dot(vl / 2.0) / (vl / 2.0).length();
-        cosSpec = (cosSpec > 0) ? cosSpec : 0;
-        // loop over each colour channel (RGBA)
-        for (unsigned int channel = 0; channel < 4; channel++)
-            v0I[channel] = 
-            ambientLight[channel]*vertex0.ambient[channel] + 
-            diffuseLight[channel]*vertex0.diffuse[channel]*cosDif + 
-            specularLight[channel]*vertex0.specular[channel]*pow(cosSpec, vertex0.exponent) +
-            vertex0.emissive[channel];
-        // repeat process for other vertices
-        // vertex 1
-        cosDif = normal1.dot(vl) / vl.length();
-        cosDif = (cosDif > 0) ? cosDif : 0;
-        cosSpec = normal1.dot(vl / 2.0) / (vl / 2.0).length();
-        cosSpec = (cosSpec > 0) ? cosSpec : 0;
-
-        for (unsigned int channel = 0; channel < 4; channel++)
-            v1I[channel] = 
-            ambientLight[channel]*vertex1.ambient[channel] + 
-            diffuseLight[channel]*vertex1.diffuse[channel]*cosDif + 
-            specularLight[channel]*vertex1.specular[channel]*pow(cosSpec, vertex1.exponent) +
-            vertex1.emissive[channel];
-
-        // vertex 2
-        cosDif = normal2.dot(vl) / vl.length();
-        cosDif = (cosDif > 0) ? cosDif : 0;
-        cosSpec = normal2.dot(vl / 2.0) / (vl / 2.0).length();
-        cosSpec = (cosSpec > 0) ? cosSpec : 0;
-
-        for (unsigned int channel = 0; channel < 4; channel++)
-            v2I[channel] = 
-            ambientLight[channel]*vertex2.ambient[channel] + 
-            diffuseLight[channel]*vertex2.diffuse[channel]*cosDif + 
-            specularLight[channel]*vertex2.specular[channel]*pow(cosSpec, vertex2.exponent) +
-            vertex2.emissive[channel];
-    }
-
-    // loop through the pixels in the bounding box
-    for (rasterFragment.row = minY; rasterFragment.row <= maxY; rasterFragment.row++)
-        { // per row
-        // this is here so that clipping works correctly
-        if (rasterFragment.row < 0) continue;
-        if (rasterFragment.row >= frameBuffer.height) continue;
-        for (rasterFragment.col = minX; rasterFragment.col <= maxX; rasterFragment.col++)
-            { // per pixel
-            // this is also for correct clipping
-            if (rasterFragment.col < 0) continue;
-            if (rasterFragment.col >= frameBuffer.width) continue;
-            
-            // the pixel in cartesian format
-            Cartesian3 pixel(rasterFragment.col, rasterFragment.row, 0.0);
-
-            // right - we have a pixel inside the frame buffer AND the bounding box
-            // note we *COULD* compute gamma = 1.0 - alpha - beta instead
-            float alpha = (normal12.dot(pixel) - lineConstant12) / distance0;           
-            float beta = (normal20.dot(pixel) - lineConstant20) / distance1;            
-            float gamma = (normal01.dot(pixel) - lineConstant01) / distance2;           
-
-            // now perform the half-plane test
-            if ((alpha < 0.0) || (beta < 0.0) || (gamma < 0.0))
-                continue;
+        {
+        normal0 = lit0.normal.unit();
+        normal1 = lit1.normal.unit();
+        normal2 = lit2.normal.unit();
+        }
 
-            // compute the depth as an interpolated sum of the depth values of the three vertices
-            float fragZ = alpha * vertex0.position.z + beta * vertex1.position.z + gamma * vertex2.position.z;
-            // we then make the fragment range between 0 and 1 using near and far from projection
-            //rasterFragment.depth = (fragZ - nearVal) / (farVal - nearVal);
-            rasterFragment.depth = (farVal - fragZ) / (farVal - nearVal);
-            
-            // clip the fragments out of clip space pixels here to save compute time
-            if (rasterFragment.depth > 1 || rasterFragment.depth < 0)
-                continue;
+    // look the materials up in the table
+    const materialRecord &material0 = materials[lit0.material];
+    shading.material0 = &material0;
+    shading.material1 = &materials[lit1.material];
+    shading.material2 = &materials[lit2.material];
+
+    // with one material over the triangle, it can be lit with premultiplied products instead of interpolating the material
+    // (the table holds each material once, so the IDs are the same just when the materials are)
+    shading.flatMaterial = lit0.material == lit1.material && lit0.material == lit2.material;
+    // one specular table serves the triangle when its vertices share an exponent, even if their colours differ
+    bool sameExponent = (material0.exponent == shading.material1->exponent) && (material0.exponent == shading.material2->exponent);
+    shading.specularPowers = sameExponent ? material0.specularPowers : NULL;
+    if (shading.flatMaterial)
+        {
+        shading.exponent = material0.exponent;
+        shading.emissive = material0.emissive;
+        // the lighting constants already have the products for their own material
+        if (lit0.material == light.material)
+            {
+            shading.ambientProduct = light.ambientProduct;
+            shading.diffuseProduct = light.diffuseProduct;
+            shading.specularProduct = light.specularProduct;
+            }
+        else
+            {
+            for (unsigned int channel = 0; channel < 4; channel++)
+                {
+                shading.materialProducts[0][channel] = light.ambientLight[channel] * material0.ambient[channel];
+                shading.materialProducts[1][channel] = light.diffuseLight[channel] * material0.DiffuseColour()[channel];
+                shading.materialProducts[2][channel] = light.specularLight[channel] * material0.SpecularColour()[channel];
+                }
+            shading.ambientProduct = shading.materialProducts[0];
+            shading.diffuseProduct = shading.materialProducts[1];
+            shading.specularProduct = shading.materialProducts[2];
+            }
+        }
 
-            // compute fragment colour
-            RGBAValue interpCol = alpha * vertex0.colour + beta * vertex1.colour + gamma * vertex2.colour;
+    // compute the light intensity at each vertex
+    // only bother computing the light intensity at each vertex when we don't want phong shading
+    if (!state.phongShading)
+        {
+        const materialRecord *vertexMaterials[3] = { shading.material0, shading.material1, shading.material2 };
+        const Cartesian3 *normals[3] = { &normal0, &normal1, &normal2 };
+        float *intensities[3] = { v0I, v1I, v2I };
+        for (unsigned int which = 0; which < 3; which++)
+            {
+            const materialRecord &material = *vertexMaterials[which];
+            float *vertexI = intensities[which];
+
+            // cosine may be negative which causes underflow as we store values as unsigned int (-1 = 2^32)
+            float cosDif = normals[which]->dot(light.lightDirection);
+            cosDif = (cosDif > 0) ? cosDif : 0;
+            float cosSpec = normals[which]->dot(light.halfVector);
+            cosSpec = (cosSpec > 0) ? cosSpec : 0;
+            float specular = SpecularPower(material.specularPowers, state.shadingPrecision, cosSpec, material.exponent);
+
+            // loop over each colour channel (RGBA)
+            if (shading.flatMaterial)
+                for (unsigned int channel = 0; channel < 4; channel++)
+                    vertexI[channel] = 
+                    shading.ambientProduct[channel] + 
+                    shading.diffuseProduct[channel]*cosDif + 
+                    shading.specularProduct[channel]*specular +
+                    shading.emissive[channel];
+            else
+                for (unsigned int channel = 0; channel < 4; channel++)
+                    vertexI[channel] = 
+                    light.ambientLight[channel]*material.ambient[channel] + 
+                    light.diffuseLight[channel]*material.DiffuseColour()[channel]*cosDif + 
+                    light.specularLight[channel]*material.SpecularColour()[channel]*specular +
+                    material.emissive[channel];
+            }
+        }
+    } // SetupTriangleShading()
+
+// shades a point of a triangle given its barycentric coordinates, specialised for the state given as FAKEGL_KERNEL bitflags
+template <unsigned int kernel>
+RGBAValue FakeGL::ShadeTriangleFragment(const triangleShading &shading, float alpha, float beta, float gamma)
+    { // ShadeTriangleFragment()
+    const screenVertexCore &vertex0 = *shading.vertex0.core, &vertex1 = *shading.vertex1.core, &vertex2 = *shading.vertex2.core;
+    const Cartesian3 &normal0 = shading.normal0, &normal1 = shading.normal1, &normal2 = shading.normal2;
+    const float *v0I = shading.v0I, *v1I = shading.v1I, *v2I = shading.v2I;
+    const lightingConstants &light = *shading.lightConstants;
+    RGBAValue colour;
+
+    if (kernel & FAKEGL_KERNEL_LIGHTING)
+        {
+        // custom gamma correction, tested for my laptop brightens the scene up a little 
+        float scalar = 44.0;
+        float exponent = 1.065;
+        
+        // shade with the approximations in FastMath.h if asked
+        bool fast = (shading.shadingPrecision == FAKEGL_FAST);
 
-            if(lighting)
+        // where the color values are stored before gamma correction
+        float R, G, B, A;
+        
+        // per fragment intensity 
+        if (kernel & FAKEGL_KERNEL_PHONG)
+            {
+            // compute light intensity per fragment, need to interpolate normals
+            Cartesian3 fragNormal = alpha * normal0 + beta * normal1 + gamma *  normal2;
+            fragNormal = fast ? FastUnit(fragNormal) : fragNormal.unit();
+
+            // compute cosines
+            float cosDif = fragNormal.dot(light.lightDirection);
+            cosDif = (cosDif > 0) ? cosDif : 0;
+            float cosSpec = fragNormal.dot(light.halfVector);
+            cosSpec = (cosSpec > 0) ? cosSpec : 0;
+
+            // compute light intensity at the fragment for each channel
+            float fragI[4];
+            if (shading.flatMaterial)
                 {
-                // custom gamma correction, tested for my laptop brightens the scene up a little 
-                float scalar = 44.0;
-                float exponent = 1.065;
-                
-                // where the color values are stored and initialised at 0;
-                float R, G, B, A = 0.0;
-                
-                // per fragment intensity 
-                if (phongShading)
-                    {
-                    // compute light intensity per fragment, need to interpolate normals
-                    Cartesian3 fragNormal = alpha * normal0 + beta * normal1 + gamma *  normal2;
-
-                    // interpolate fragment attributes
-                    float fragExponent = alpha * vertex0.exponent + beta * vertex1.exponent + gamma * vertex2.exponent;
-                    float fragAmbient[4], fragDiffuse[4], fragSpecular[4], fragEmissive[4];
-                    // do this for each RGBA channel
-                    for (unsigned int i = 0; i < 4; i++)
-                        {
-                        fragAmbient[i] = alpha * vertex0.ambient[i] + beta * vertex1.ambient[i] + gamma * vertex2.ambient[i];
-                        fragDiffuse[i] = alpha * vertex0.diffuse[i] + beta * vertex1.diffuse[i] + gamma * vertex2.diffuse[i];
-                        fragSpecular[i] = alpha * vertex0.specular[i] + beta * vertex1.specular[i] + gamma * vertex2.specular[i];
-                        fragEmissive[i] = alpha * vertex0.emissive[i] + beta * vertex1.emissive[i] + gamma * vertex2.emissive[i];
-                        }
-
-                    // compute cosines
-                    float cosDif = fragNormal.unit().dot(vl) / vl.length();
-                    cosDif = (cosDif > 0) ? cosDif : 0;
-                    float cosSpec = fragNormal.unit().dot(vl / 2.0) / (vl / 2.0).length();
-                    cosSpec = (cosSpec > 0) ? cosSpec : 0;
-
-                    // compute light intensity at the fragment for each channel
-                    float fragI[4];
-                    for (unsigned int channel = 0; channel < 4; channel++)
-                        fragI[channel] = 
-                        ambientLight[channel]*fragAmbient[channel] + 
-                        diffuseLight[channel]*fragDiffuse[channel]*cosDif + 
-                        specularLight[channel]*fragSpecular[channel]*pow(cosSpec, fragExponent) +
-                        fragEmissive[channel];
-                    
-                    // compute colour for each of the fragment's channels
-                    R = pow((alpha * vertex0.colour.red * fragI[0] + beta * vertex1.colour.red * fragI[0] + gamma * vertex2.colour.red * fragI[0]), exponent) + scalar;
-                    G = pow((alpha * vertex0.colour.green * fragI[1] + beta * vertex1.colour.green * fragI[1] + gamma * vertex2.colour.green * fragI[1]), exponent) + scalar;
-                    B = pow((alpha * vertex0.colour.blue * fragI[2] + beta * vertex1.colour.blue * fragI[2] + gamma * vertex2.colour.blue * fragI[2]), exponent) + scalar; 
-                    A = pow((alpha * vertex0.colour.alpha * fragI[3] + beta * vertex1.colour.alpha * fragI[3] + gamma * vertex2.colour.alpha * fragI[3]), exponent) + scalar; 
-                    }
-                else
+                // the material is the same everywhere, so the products need no interpolating
+                float specular = SpecularPower(shading.specularPowers, shading.shadingPrecision, cosSpec, shading.exponent);
+                for (unsigned int channel = 0; channel < 4; channel++)
+                    fragI[channel] = 
+                    shading.ambientProduct[channel] + 
+                    shading.diffuseProduct[channel]*cosDif + 
+                    shading.specularProduct[channel]*specular +
+                    shading.emissive[channel];
+                }
+            else
+                {
+                // interpolate fragment attributes
+                const materialRecord &material0 = *shading.material0, &material1 = *shading.material1, &material2 = *shading.material2;
+                float fragExponent = alpha * material0.exponent + beta * material1.exponent + gamma * material2.exponent;
+                float specular = SpecularPower(shading.specularPowers, shading.shadingPrecision, cosSpec, fragExponent);
+                // do this for each RGBA channel
+                for (unsigned int channel = 0; channel < 4; channel++)
                     {
-                    // interpolate fragment's intensity using the three vertices' intensity
-                    R = pow((alpha * vertex0.colour.red * v0I[0] + beta * vertex1.colour.red * v1I[0] + gamma * vertex2.colour.red * v2I[0]), exponent) + scalar;
-                    G = pow((alpha * vertex0.colour.green * v0I[1] + beta * vertex1.colour.green * v1I[1] + gamma * vertex2.colour.green * v2I[1]), exponent) + scalar;
-                    B = pow((alpha * vertex0.colour.blue * v0I[2] + beta * vertex1.colour.blue * v1I[2] + gamma * vertex2.colour.blue * v2I[2]), exponent) + scalar; 
-                    A = pow((alpha * vertex0.colour.alpha * v0I[3] + beta * vertex1.colour.alpha * v1I[3] + gamma * vertex2.colour.alpha * v2I[3]), exponent) + scalar; 
+                    float fragAmbient = alpha * material0.ambient[channel] + beta * material1.ambient[channel] + gamma * material2.ambient[channel];
+                    float fragDiffuse = alpha * material0.DiffuseColour()[channel] + beta * material1.DiffuseColour()[channel] + gamma * material2.DiffuseColour()[channel];
+                    float fragSpecular = alpha * material0.SpecularColour()[channel] + beta * material1.SpecularColour()[channel] + gamma * material2.SpecularColour()[channel];
+                    float fragEmissive = alpha * material0.emissive[channel] + beta * material1.emissive[channel] + gamma * material2.emissive[channel];
+                    fragI[channel] = 
+                    light.ambientLight[channel]*fragAmbient + 
+                    light.diffuseLight[channel]*fragDiffuse*cosDif + 
+                    light.specularLight[channel]*fragSpecular*specular +
+                    fragEmissive;
                     }
-                // assign the computed colour channels to the fragment
-                rasterFragment.colour = RGBAValue(R, G, B, A);
                 }
-            else
-                rasterFragment.colour = interpCol;
             
-            // compute interpolated texture coordinates and set colour
-            if (texture)
+            // compute colour for each of the fragment's channels
+            if (shading.flatColour)
+                {
+                R = vertex0.colour.red * fragI[0];
+                G = vertex0.colour.green * fragI[1];
+                B = vertex0.colour.blue * fragI[2];
+                A = vertex0.colour.alpha * fragI[3];
+                }
+            else
+                {
+                R = alpha * vertex0.colour.red * fragI[0] + beta * vertex1.colour.red * fragI[0] + gamma * vertex2.colour.red * fragI[0];
+                G = alpha * vertex0.colour.green * fragI[1] + beta * vertex1.colour.green * fragI[1] + gamma * vertex2.colour.green * fragI[1];
+                B = alpha * vertex0.colour.blue * fragI[2] + beta * vertex1.colour.blue * fragI[2] + gamma * vertex2.colour.blue * fragI[2];
+                A = alpha * vertex0.colour.alpha * fragI[3] + beta * vertex1.colour.alpha * fragI[3] + gamma * vertex2.colour.alpha * fragI[3];
+                }
+            }
+        else
+            {
+            // interpolate fragment's intensity using the three vertices' intensity
+            if (shading.flatColour)
                 {
-                // get the coordinates and implicit cast to int
-                int interpU = (alpha * vertex0.u + beta * vertex1.u + gamma * vertex2.u) * textureData.height;
-                int interpV = (alpha * vertex0.v + beta * vertex1.v + gamma * vertex2.v) * textureData.width;
-
-                // if modulate then multiply by current fragment colour, other wise replace colour
-                if (texMode == FAKEGL_MODULATE)
-                    rasterFragment.colour = rasterFragment.colour.modulate(textureData[interpU][interpV]);
-                else if (texMode == FAKEGL_REPLACE)
-                    rasterFragment.colour = textureData[interpU][interpV];  
+                R = vertex0.colour.red * (alpha * v0I[0] + beta * v1I[0] + gamma * v2I[0]);
+                G = vertex0.colour.green * (alpha * v0I[1] + beta * v1I[1] + gamma * v2I[1]);
+                B = vertex0.colour.blue * (alpha * v0I[2] + beta * v1I[2] + gamma * v2I[2]);
+                A = vertex0.colour.alpha * (alpha * v0I[3] + beta * v1I[3] + gamma * v2I[3]);
                 }
+            else
+                {
+                R = alpha * vertex0.colour.red * v0I[0] + beta * vertex1.colour.red * v1I[0] + gamma * vertex2.colour.red * v2I[0];
+                G = alpha * vertex0.colour.green * v0I[1] + beta * vertex1.colour.green * v1I[1] + gamma * vertex2.colour.green * v2I[1];
+                B = alpha * vertex0.colour.blue * v0I[2] + beta * vertex1.colour.blue * v1I[2] + gamma * vertex2.colour.blue * v2I[2];
+                A = alpha * vertex0.colour.alpha * v0I[3] + beta * vertex1.colour.alpha * v1I[3] + gamma * vertex2.colour.alpha * v2I[3];
+                }
+            }
+        // gamma correct & assign the computed colour channels to the fragment
+        if (fast)
+            {
+            // as a loop over the channels, so the four can be done at once
+            float channels[4] = { R, G, B, A };
+            for (unsigned int channel = 0; channel < 4; channel++)
+                channels[channel] = FastPow(channels[channel], exponent) + scalar;
+            colour = RGBAValue(channels[0], channels[1], channels[2], channels[3]);
+            }
+        else
+            colour = RGBAValue(pow(R, exponent) + scalar, pow(G, exponent) + scalar, pow(B, exponent) + scalar, pow(A, exponent) + scalar);
+        }
+    else if (shading.flatColour)
+        colour = vertex0.colour;
+    else
+        colour = alpha * vertex0.colour + beta * vertex1.colour + gamma * vertex2.colour;
+    
+    // compute interpolated texture coordinates and set colour
+    if (kernel & (FAKEGL_KERNEL_MODULATE | FAKEGL_KERNEL_REPLACE))
+        {
+        // get the coordinates and implicit cast to int
+        const screenVertexTexCoord &texCoord0 = *shading.vertex0.texCoord, &texCoord1 = *shading.vertex1.texCoord, &texCoord2 = *shading.vertex2.texCoord;
+        int interpU = (alpha * texCoord0.u + beta * texCoord1.u + gamma * texCoord2.u) * textureData.height;
+        int interpV = (alpha * texCoord0.v + beta * texCoord1.v + gamma * texCoord2.v) * textureData.width;
+
+        // if modulate then multiply by current fragment colour, other wise replace colour
+        if (kernel & FAKEGL_KERNEL_MODULATE)
+            colour = colour.modulate(textureData[interpU][interpV]);
+        else
+            colour = textureData[interpU][interpV];  
+        }
 
-            // now we add it to the queue for fragment processing
-            fragmentQueue.push_back(rasterFragment);
-            } // per pixel
-        } // per row
-    } // RasteriseTriangle()
+    return colour;
+    } // ShadeTriangleFragment()
+
+// the FAKEGL_KERNEL bitflags for drawing with the given state
+unsigned int FakeGL::KernelFlags(unsigned int lighting, unsigned int phongShading, unsigned int texture, unsigned int texMode, unsigned int depthTest)
+    { // KernelFlags()
+    unsigned int kernel = 0;
+    if (lighting)
+        kernel |= FAKEGL_KERNEL_LIGHTING;
+    if (phongShading)
+        kernel |= FAKEGL_KERNEL_PHONG;
+    // a texture mode other than these two leaves the colour as it is
+    if (texture && (texMode == FAKEGL_MODULATE))
+        kernel |= FAKEGL_KERNEL_MODULATE;
+    else if (texture && (texMode == FAKEGL_REPLACE))
+        kernel |= FAKEGL_KERNEL_REPLACE;
+    if (depthTest)
+        kernel |= FAKEGL_KERNEL_DEPTH_TEST;
+    return kernel;
+    } // KernelFlags()
+
+// fills the table of raster kernels, with each entry the kernel for the bitflags it is indexed by
+template <unsigned int... kernels>
+std::array<FakeGL::rasterKernel, sizeof...(kernels)> FakeGL::RasterKernels(std::integer_sequence<unsigned int, kernels...>)
+    { // RasterKernels()
+    return {{ &FakeGL::RasteriseTriangleKernel<fixedFunctionShader<CanonicalKernel(kernels) & FAKEGL_KERNEL_SHADING>, CanonicalKernel(kernels) & ~FAKEGL_KERNEL_SHADING>... }};
+    } // RasterKernels()
+
+// and the table of shading kernels
+template <unsigned int... kernels>
+std::array<FakeGL::shadeKernel, sizeof...(kernels)> FakeGL::ShadeKernels(std::integer_sequence<unsigned int, kernels...>)
+    { // ShadeKernels()
+    return {{ &FakeGL::ShadeTriangleFragment<CanonicalKernel(kernels)>... }};
+    } // ShadeKernels()
+
+const std::array<FakeGL::rasterKernel, FAKEGL_RASTER_KERNELS> FakeGL::rasterKernels = FakeGL::RasterKernels(std::make_integer_sequence<unsigned int, FAKEGL_RASTER_KERNELS>());
+const std::array<FakeGL::shadeKernel, FAKEGL_SHADE_KERNELS> FakeGL::shadeKernels = FakeGL::ShadeKernels(std::make_integer_sequence<unsigned int, FAKEGL_SHADE_KERNELS>());
+
+// cos^exponent for the specular term, from the material's table in fast shading when it has one
+float FakeGL::SpecularPower(const float *specularPowers, unsigned int shadingPrecision, float cosSpec, float exponent)
+    { // SpecularPower()
+    if (shadingPrecision != FAKEGL_FAST)
+        return pow(cosSpec, exponent);
+    if (specularPowers != NULL)
+        return FastLookup(specularPowers, FAKEGL_SPECULAR_TABLE_SIZE, cosSpec);
+    return FastPow(cosSpec, exponent);
+    } // SpecularPower()
 
 // process a single fragment
 void FakeGL::ProcessFragment()
     { // ProcessFragment()
+    // process the fragment at the front of the queue
+    ProcessFragment(fragmentQueue.front());
+
+    // remove fragment from the queue
+    fragmentQueue.pop_front();
+    } // ProcessFragment()
 
-    // get fragment data from the front of the queue
-    fragmentWithAttributes fragment = fragmentQueue.front();
+// process a given fragment
+void FakeGL::ProcessFragment(const fragmentWithAttributes &fragment)
+    { // ProcessFragment()
     // where we do the depth checking? ... before we set the fragment in the frame buffer
-    if(depthTest)
+    if(depthTest && !fragment.depthTested)
         {
-        // remember that RGBA values are char ranging from 0 to 255... so convert depth ([0, 1]) by multiplying by 255
-        if (fragment.depth * 255 <= (float)depthBuffer[fragment.row][fragment.col].alpha)
+        // the depth buffer compares & updates in its own format
+        if (depthBuffer.TestAndSet(fragment.row, fragment.col, fragment.depth))
             {
             // first we update the frame buffer
             frameBuffer[fragment.row][fragment.col].red = fragment.colour.red;  
@@ -1053,9 +2634,9 @@ void FakeGL::ProcessFragment()
             frameBuffer[fragment.row][fragment.col].blue = fragment.colour.blue;  
             frameBuffer[fragment.row][fragment.col].alpha = fragment.colour.alpha;
 
-            // and we don't forget to update the depthBuffer (casts to unsigned char)
-            depthBuffer[fragment.row][fragment.col].alpha = fragment.depth * 255;
-            //std::cout << (int)(fragment.depth * 255) << std::endl;
+            // a point or line now hides whatever triangle the visibility buffer was going to shade here
+            if (!visibilityBuffer.empty())
+                visibilityBuffer[fragment.row * frameBuffer.width + fragment.col].triangle = FAKEGL_NO_TRIANGLE;
             }
         }
     else
@@ -1065,12 +2646,31 @@ void FakeGL::ProcessFragment()
         frameBuffer[fragment.row][fragment.col].green = fragment.colour.green;  
         frameBuffer[fragment.row][fragment.col].blue = fragment.colour.blue;  
         frameBuffer[fragment.row][fragment.col].alpha = fragment.colour.alpha;
-        }
 
-    // remove fragment from the queue
-    fragmentQueue.pop_front();
+        // as above
+        if (!visibilityBuffer.empty())
+            visibilityBuffer[fragment.row * frameBuffer.width + fragment.col].triangle = FAKEGL_NO_TRIANGLE;
+        }
     } // ProcessFragment()
 
+// writes a run of pixels of one colour & depth along a row, as ProcessFragment() would each in turn
+void FakeGL::WriteSpan(int row, int firstCol, int lastCol, const RGBAValue &colour, float depth)
+    { // WriteSpan()
+    RGBAValue *pixel = frameBuffer[row];
+    for (int col = firstCol; col <= lastCol; col++)
+        { // per pixel
+        // the depth buffer compares & updates in its own format
+        if (depthTest && !depthBuffer.TestAndSet(row, col, depth))
+            continue;
+
+        pixel[col] = colour;
+
+        // a point now hides whatever triangle the visibility buffer was going to shade here
+        if (!visibilityBuffer.empty())
+            visibilityBuffer[row * frameBuffer.width + col].triangle = FAKEGL_NO_TRIANGLE;
+        } // per pixel
+    } // WriteSpan()
+
 // standard routine for dumping the entire FakeGL context (except for texture / image)
 std::ostream &operator << (std::ostream &outStream, FakeGL &fakeGL)
     { // operator <<
@@ -1089,6 +2689,36 @@ std::ostream &operator << (std::ostream &outStream, FakeGL &fakeGL)
         } // per matrix
 
 
+    outStream << "-------------------------" << std::endl;
+    outStream << "Vertex Cache:            " << std::endl;
+    outStream << "-------------------------" << std::endl;
+    outStream << "Hits:       " << fakeGL.vertexCacheHits << std::endl;
+    outStream << "Misses:     " << fakeGL.vertexCacheMisses << std::endl;
+    outStream << "Hit Rate:   " << fakeGL.VertexCacheHitRate() << std::endl;
+
+
+    outStream << "-------------------------" << std::endl;
+    outStream << "Raster Blocks:           " << std::endl;
+    outStream << "-------------------------" << std::endl;
+    outStream << "Rejected:   " << fakeGL.blocksRejected << std::endl;
+    outStream << "Covered:    " << fakeGL.blocksCovered << std::endl;
+    outStream << "Partial:    " << fakeGL.blocksPartial << std::endl;
+
+
+    outStream << "-------------------------" << std::endl;
+    outStream << "Early Depth Test:        " << std::endl;
+    outStream << "-------------------------" << std::endl;
+    outStream << "Shading Skipped: " << fakeGL.fragmentsShadingSkipped << std::endl;
+
+
+    outStream << "-------------------------" << std::endl;
+    outStream << "Culled Triangles:        " << std::endl;
+    outStream << "-------------------------" << std::endl;
+    outStream << "Face:       " << fakeGL.trianglesFaceCulled << std::endl;
+    outStream << "Frustum:    " << fakeGL.trianglesFrustumCulled << std::endl;
+    outStream << "Clipped:    " << fakeGL.trianglesClipped << std::endl;
+
+
     outStream << "-------------------------" << std::endl;
     outStream << "Raster Queue:            " << std::endl;
     outStream << "-------------------------" << std::endl;
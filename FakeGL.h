@@ -22,8 +22,17 @@
 #include "Homogeneous4.h"
 #include "Matrix4.h"
 #include "RGBAImage.h"
+#include "DepthBuffer.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <deque>
+#include <map>
+#include <array>
+#include <utility>
+#include <string.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
 
 // we will store all of the FakeGL context in a class object
 // this is similar to the real OpenGL which handles multiple windows
@@ -46,6 +55,21 @@ const unsigned int FAKEGL_LIGHTING = 1;
 const unsigned int FAKEGL_TEXTURE_2D = 2;
 const unsigned int FAKEGL_DEPTH_TEST = 3;
 const unsigned int FAKEGL_PHONG_SHADING = 4;
+const unsigned int FAKEGL_DEFERRED_PIPELINE = 5;
+const unsigned int FAKEGL_VISIBILITY_BUFFER = 6;
+const unsigned int FAKEGL_CULL_FACE = 7;
+const unsigned int FAKEGL_SCISSOR_TEST = 8;
+// constants for Hint()
+const unsigned int FAKEGL_SHADING_PRECISION = 1;
+const unsigned int FAKEGL_FAST = 1;
+const unsigned int FAKEGL_NICEST = 2;
+// constants for CullFace()
+const unsigned int FAKEGL_FRONT = 1;
+const unsigned int FAKEGL_BACK = 2;
+const unsigned int FAKEGL_FRONT_AND_BACK = 3;
+// constants for FrontFace()
+const unsigned int FAKEGL_CW = 1;
+const unsigned int FAKEGL_CCW = 2;
 // constants for Light() - actually bit flags
 const unsigned int FAKEGL_POSITION = 1;
 const unsigned int FAKEGL_AMBIENT = 2;
@@ -61,6 +85,60 @@ const unsigned int FAKEGL_PROJECTION = 2;
 // constants for texture operations
 const unsigned int FAKEGL_MODULATE = 1;
 const unsigned int FAKEGL_REPLACE = 2;
+// constants for EnableClientState()/DisableClientState()
+const unsigned int FAKEGL_VERTEX_ARRAY = 1;
+const unsigned int FAKEGL_NORMAL_ARRAY = 2;
+const unsigned int FAKEGL_TEXTURE_COORD_ARRAY = 3;
+const unsigned int FAKEGL_COLOR_ARRAY = 4;
+// bitflags for the vertex attributes beyond position & colour that the state needs, as vertices only carry those
+const unsigned int FAKEGL_ATTRIBUTE_NORMAL = 1;
+const unsigned int FAKEGL_ATTRIBUTE_TEXCOORD = 2;
+// size in pixels of the square tiles used by the multithreaded rasteriser
+const int FAKEGL_TILE_SIZE = 64;
+// number of vertices handed to each thread at a time by the transform stage
+const unsigned int FAKEGL_TRANSFORM_CHUNK = 1024;
+// size in pixels of the square blocks triangles are classified against before testing pixels (divides FAKEGL_TILE_SIZE)
+const int FAKEGL_RASTER_BLOCK = 8;
+// bits of sub-pixel precision that triangle vertices are snapped to
+const int FAKEGL_SUBPIXEL_BITS = 4;
+// bitflags for the sides of the visible volume (the view volume widened to the frame buffer) a vertex lies outside
+const unsigned int FAKEGL_CLIP_LEFT = 1;
+const unsigned int FAKEGL_CLIP_RIGHT = 2;
+const unsigned int FAKEGL_CLIP_BOTTOM = 4;
+const unsigned int FAKEGL_CLIP_TOP = 8;
+// and for the clipping planes: near & far, and the sides of the guard band
+const unsigned int FAKEGL_CLIP_NEAR = 16;
+const unsigned int FAKEGL_CLIP_FAR = 32;
+const unsigned int FAKEGL_CLIP_GUARD_LEFT = 64;
+const unsigned int FAKEGL_CLIP_GUARD_RIGHT = 128;
+const unsigned int FAKEGL_CLIP_GUARD_BOTTOM = 256;
+const unsigned int FAKEGL_CLIP_GUARD_TOP = 512;
+// the clip codes that mean a triangle must be clipped before it is rasterised
+const unsigned int FAKEGL_CLIP_PLANES = FAKEGL_CLIP_NEAR | FAKEGL_CLIP_FAR | FAKEGL_CLIP_GUARD_LEFT | FAKEGL_CLIP_GUARD_RIGHT | FAKEGL_CLIP_GUARD_BOTTOM | FAKEGL_CLIP_GUARD_TOP;
+// distance in pixels beyond the frame buffer that triangles may reach without being clipped
+// (the rasteriser steps edges within a block in 32 bits, which relies on this staying modest)
+const float FAKEGL_GUARD_BAND = 1024.0;
+// number of entries the material table may hold, so that material IDs fit in 16 bits
+const unsigned int FAKEGL_MAX_MATERIALS = 65536;
+// number of intervals the tables of cos^shininess used in fast shading divide [0, 1] into
+const int FAKEGL_SPECULAR_TABLE_SIZE = 1024;
+// number of those tables kept before they are thrown away & made again as needed
+const unsigned int FAKEGL_MAX_SPECULAR_TABLES = 64;
+// triangle ID of a visibility buffer pixel that no triangle covers
+const unsigned int FAKEGL_NO_TRIANGLE = 0xFFFFFFFF;
+// bitflags for the state a triangle raster kernel is specialised for
+const unsigned int FAKEGL_KERNEL_LIGHTING = 1;
+const unsigned int FAKEGL_KERNEL_PHONG = 2;
+const unsigned int FAKEGL_KERNEL_MODULATE = 4;
+const unsigned int FAKEGL_KERNEL_REPLACE = 8;
+const unsigned int FAKEGL_KERNEL_DEPTH_TEST = 16;
+const unsigned int FAKEGL_KERNEL_VISIBILITY = 32;
+// the bitflags that shading depends on
+const unsigned int FAKEGL_KERNEL_SHADING = FAKEGL_KERNEL_LIGHTING | FAKEGL_KERNEL_PHONG | FAKEGL_KERNEL_MODULATE | FAKEGL_KERNEL_REPLACE;
+// number of combinations of those bitflags, each of which has a kernel
+const unsigned int FAKEGL_RASTER_KERNELS = 64;
+// and of those that shading depends on
+const unsigned int FAKEGL_SHADE_KERNELS = FAKEGL_KERNEL_SHADING + 1;
 // constant for converting degrees to radians
 const float PI = 3.1415927410125732421875;
 
@@ -77,21 +155,187 @@ class vertexWithAttributes
     // Normal 
     Homogeneous4 normal;
 
-    // material properties
-    float* ambient;
-    float* diffuse;
-    float* specular;
-    float* emissive;
-    float exponent;
+    // material properties, as an ID in the material table
+    unsigned short material;
 
     // Texture coords
     float u;
     float v;
     }; // class vertexWithAttributes
 
-// class for a vertex after transformation to screen space
-class screenVertexWithAttributes
-    { // class screenVertexWithAttributes
+// class describing a client-side array of vertex attributes
+// the data belongs to the caller, we only keep a pointer to it
+class vertexAttributeArray
+    { // class vertexAttributeArray
+    public:
+    // whether the array is enabled, acts as a boolean
+    unsigned int enabled;
+
+    // number of floats per element
+    int size;
+
+    // byte offset between consecutive elements, 0 means tightly packed
+    int stride;
+
+    // the caller's data
+    const float *pointer;
+
+    // constructor
+    vertexAttributeArray();
+
+    // retrieves the start of the element at a given index
+    const float * operator [](const unsigned int index) const;
+    }; // class vertexAttributeArray
+
+// class holding one set of material properties, an entry in the material table
+// entries never change once made, so that vertices aren't affected by later Material*() calls
+class materialRecord
+    { // class materialRecord
+    public:
+    float ambient[4];
+    float diffuse[4];
+    float specular[4];
+    float emissive[4];
+    float exponent;
+
+    // table of cos^exponent for fast shading, FAKEGL_SPECULAR_TABLE_SIZE + 1 samples over [0, 1], or NULL without one
+    // it is shared by every material with the same exponent, and isn't part of the material itself
+    const float *specularPowers;
+
+    // the colours the shading multiplies the diffuse & specular terms by: it has always lit each term
+    // with the other's colour, and this is the one place that keeps it so
+    const float *DiffuseColour() const
+        { // DiffuseColour()
+        return specular;
+        } // DiffuseColour()
+    const float *SpecularColour() const
+        { // SpecularColour()
+        return diffuse;
+        } // SpecularColour()
+
+    // an arbitrary order on the bytes of the properties, so that materials can be looked up in a map
+    bool operator <(const materialRecord &other) const
+        { // operator <()
+        return memcmp(this, &other, offsetof(materialRecord, exponent) + sizeof(exponent)) < 0;
+        } // operator <()
+    }; // class materialRecord
+
+// class for a table of cos^shininess for fast shading, with when it was last given to new vertices
+class specularTable
+    { // class specularTable
+    public:
+    // FAKEGL_SPECULAR_TABLE_SIZE + 1 samples over [0, 1]
+    std::vector<float> powers;
+
+    // the flush count at the time, so that tables nothing waiting to be drawn uses can be told apart
+    unsigned long lastUsed;
+    }; // class specularTable
+
+// class for the lighting values that only change with the light or the material, worked out once rather than per fragment
+class lightingConstants
+    { // class lightingConstants
+    public:
+    // unit vector towards the light, and the half vector of the specular term
+    Cartesian3 lightDirection;
+    Cartesian3 halfVector;
+
+    // the light's components
+    float ambientLight[4];
+    float diffuseLight[4];
+    float specularLight[4];
+
+    // ID of the material the products are for
+    unsigned short material;
+
+    // the light's components premultiplied by the material's
+    float ambientProduct[4];
+    float diffuseProduct[4];
+    float specularProduct[4];
+    }; // class lightingConstants
+
+// class holding the state that affects how recorded primitives are drawn
+// (vertex attributes are recorded with the vertices themselves)
+class renderState
+    { // class renderState
+    public:
+    // matrices at the top of the stacks
+    Matrix4 modelView;
+    Matrix4 projection;
+
+    // viewport
+    float xPixelOrigin;
+    float yPixelOrigin;
+    float viewPortSize;
+
+    // scissor box
+    int scissorX;
+    int scissorY;
+    int scissorWidth;
+    int scissorHeight;
+
+    // enabled attributes
+    unsigned int lighting;
+    unsigned int texture;
+    unsigned int depthTest;
+    unsigned int phongShading;
+    unsigned int texMode;
+    unsigned int cullFace;
+    unsigned int cullFaceMode;
+    unsigned int frontFace;
+    unsigned int scissorTest;
+    unsigned int shadingPrecision;
+
+    // the light
+    Homogeneous4 lightPosition;
+    float ambientLight[4];
+    float diffuseLight[4];
+    float specularLight[4];
+    lightingConstants lightConstants;
+
+    // raster state
+    float pointSize;
+    float lineWidth;
+    float nearVal;
+    float farVal;
+    }; // class renderState
+
+// class for the part of the state that shading a triangle reads, referring to the light constants rather than copying them
+class shadingState
+    { // class shadingState
+    public:
+    // enabled attributes
+    unsigned int lighting;
+    unsigned int texture;
+    unsigned int phongShading;
+    unsigned int texMode;
+    unsigned int shadingPrecision;
+
+    // the light
+    const lightingConstants *lightConstants;
+    }; // class shadingState
+
+// class for a batch of primitives recorded in deferred mode
+class deferredBatch
+    { // class deferredBatch
+    public:
+    // primitive type from Begin() or the draw call
+    unsigned int primitive;
+
+    // range of the batch's vertices in deferredVertices
+    unsigned int firstVertex;
+    unsigned int vertexCount;
+
+    // range of the batch's indices in deferredIndices, empty if the vertices are used in order
+    unsigned int firstIndex;
+    unsigned int indexCount;
+
+    // state at the time of recording
+    renderState state;
+    }; // class deferredBatch
+
+// class for the part of a vertex after transformation to screen space that every state uses
+class screenVertexCore
+    { // class screenVertexCore
     public:
 	// Position in DCS
     Cartesian3 position;
@@ -99,21 +343,101 @@ class screenVertexWithAttributes
 	// Colour
     RGBAValue colour;
 
+    // Position in clip space, kept for clipping against the near & far planes and the guard band
+    Homogeneous4 clipPosition;
+
+    // the sides of the visible volume & the clipping planes the vertex lies outside, as FAKEGL_CLIP_* bits
+    unsigned int clipCodes;
+    }; // class screenVertexCore
+
+// class for the part only lighting uses, FAKEGL_ATTRIBUTE_NORMAL
+class screenVertexNormal
+    { // class screenVertexNormal
+    public:
     // Normal 
     Cartesian3 normal;
 
-    // material properties
-    float* ambient;
-    float* diffuse;
-    float* specular;
-    float* emissive;
-    float exponent;
+    // material properties, as an ID in the material table
+    unsigned short material;
+    }; // class screenVertexNormal
 
+// class for the part only texturing uses, FAKEGL_ATTRIBUTE_TEXCOORD
+class screenVertexTexCoord
+    { // class screenVertexTexCoord
+    public:
     // Texture coords
     float u;
     float v;
+    }; // class screenVertexTexCoord
+
+// class for a vertex after transformation to screen space, with all of its parts
+class screenVertexWithAttributes : public screenVertexCore, public screenVertexNormal, public screenVertexTexCoord
+    { // class screenVertexWithAttributes
     }; // class screenVertexWithAttributes
 
+// class for where the parts of one transformed vertex are, so that the rasteriser reads them straight from
+// a batch's arrays, or from a whole vertex, without copying them together
+class screenVertexParts
+    { // class screenVertexParts
+    public:
+    // the part every vertex has
+    const screenVertexCore *core;
+
+    // the other parts, NULL when the state leaves them out
+    const screenVertexNormal *normal;
+    const screenVertexTexCoord *texCoord;
+
+    // constructors
+    screenVertexParts()
+        : core(NULL), normal(NULL), texCoord(NULL)
+        { // constructor
+        } // constructor
+    screenVertexParts(const screenVertexCore *core, const screenVertexNormal *normal, const screenVertexTexCoord *texCoord)
+        : core(core), normal(normal), texCoord(texCoord)
+        { // constructor
+        } // constructor
+    // a whole vertex has them all
+    screenVertexParts(const screenVertexWithAttributes &vertex)
+        : core(&vertex), normal(&vertex), texCoord(&vertex)
+        { // constructor
+        } // constructor
+
+    // puts the parts together, for the little that needs a whole vertex
+    void Gather(screenVertexWithAttributes &vertex) const
+        { // Gather()
+        static_cast<screenVertexCore &>(vertex) = *core;
+        if (normal != NULL)
+            static_cast<screenVertexNormal &>(vertex) = *normal;
+        if (texCoord != NULL)
+            static_cast<screenVertexTexCoord &>(vertex) = *texCoord;
+        } // Gather()
+    }; // class screenVertexParts
+
+// class for a batch of vertices after transformation, kept as an array for each part so that
+// the parts the state leaves out take no room: 36 bytes a vertex unlit & untextured, up to 60
+class screenVertexBatch
+    { // class screenVertexBatch
+    public:
+    // the parts every vertex has
+    screenVertexCore *cores;
+
+    // the other parts, NULL when the state leaves them out
+    screenVertexNormal *normals;
+    screenVertexTexCoord *texCoords;
+
+    // the parts there are, as FAKEGL_ATTRIBUTE_* bits
+    unsigned int Attributes() const
+        { // Attributes()
+        return ((normals != NULL) ? FAKEGL_ATTRIBUTE_NORMAL : 0) | ((texCoords != NULL) ? FAKEGL_ATTRIBUTE_TEXCOORD : 0);
+        } // Attributes()
+
+    // where the parts of a vertex are, for the rasteriser
+    screenVertexParts Parts(unsigned int index) const
+        { // Parts()
+        return screenVertexParts(&(cores[index]), (normals != NULL) ? &(normals[index]) : NULL, (texCoords != NULL) ? &(texCoords[index]) : NULL);
+        } // Parts()
+    }; // class screenVertexBatch
+
 // class for a fragment with attributes
 class fragmentWithAttributes
     { // class fragmentWithAttributes
@@ -127,8 +451,108 @@ class fragmentWithAttributes
     // the depth value (z) of the fragment, used for depth test
     float depth;
 
+    // true if the rasteriser has already passed the fragment through the depth test
+    bool depthTested;
+
     }; // class fragmentWithAttributes
 
+// class for a rectangle of the frame buffer that a rasteriser may write to
+// the bounds are inclusive, and must lie within the frame buffer
+class rasterRegion
+    { // class rasterRegion
+    public:
+    int minRow, maxRow;
+    int minCol, maxCol;
+    }; // class rasterRegion
+
+// class for the columns one row of a point covers, as offsets from the left of the point's box
+class pointSpan
+    { // class pointSpan
+    public:
+    int firstCol, lastCol;
+    }; // class pointSpan
+
+// class for one edge of a triangle in the fixed point rasteriser, whose value is exact
+// it is positive inside the triangle, whichever way round the vertices run
+class triangleEdge
+    { // class triangleEdge
+    public:
+    // the value at row 0, column 0, and the steps from one column & one row to the next
+    long long origin;
+    long long columnStep, rowStep;
+
+    // a pixel is inside if the value there is above the limit: -1 on the top & left edges,
+    // which own the pixels exactly on them, and 0 on the others
+    long long limit;
+    }; // class triangleEdge
+
+// class for what shading the fragments of a triangle needs, worked out once per triangle
+class triangleShading
+    { // class triangleShading
+    public:
+    // the state the triangle is drawn with, the part the shading kernels are specialised for as FAKEGL_KERNEL bitflags
+    unsigned int kernel;
+    unsigned int shadingPrecision;
+    const lightingConstants *lightConstants;
+
+    // set when all three vertices share one material, which is then lit with the premultiplied products below
+    // (the lighting constants' own if it is their material), rather than interpolated
+    unsigned int flatMaterial;
+    const float *ambientProduct;
+    const float *diffuseProduct;
+    const float *specularProduct;
+    const float *emissive;
+    float exponent;
+
+    // the table of cos^exponent in fast shading, when the vertices share an exponent that has one
+    const float *specularPowers;
+
+    // the materials at the vertices, for when they differ
+    const materialRecord *material0;
+    const materialRecord *material1;
+    const materialRecord *material2;
+
+    // the products when they have to be worked out for this triangle
+    float materialProducts[3][4];
+
+    // set when all three vertices have the same colour, which then needn't be interpolated
+    unsigned int flatColour;
+
+    // the transformed vertices
+    screenVertexParts vertex0;
+    screenVertexParts vertex1;
+    screenVertexParts vertex2;
+
+    // unit normals at the vertices
+    Cartesian3 normal0, normal1, normal2;
+
+    // light intensity at each vertex, for Gouraud shading
+    float v0I[4], v1I[4], v2I[4];
+    }; // class triangleShading
+
+// class for a triangle drawn into the visibility buffer
+class visibilityTriangle
+    { // class visibilityTriangle
+    public:
+    // the deferred batch it belongs to, whose state it is shaded with
+    unsigned int batch;
+
+    // whether it is a piece of a clipped triangle, whose vertices are new
+    bool clipped;
+
+    // its vertices in deferredScreenVertices & the other deferred screen vertex parts,
+    // or in visibilityClipVertices for a piece
+    unsigned int vertex0, vertex1, vertex2;
+    }; // class visibilityTriangle
+
+// class for a pixel of the visibility buffer: the nearest triangle & where the pixel lies in it
+class visibilitySample
+    { // class visibilitySample
+    public:
+    unsigned int triangle;
+    float alpha, beta, gamma;
+    }; // class visibilitySample
+
 // the class storing the FakeGL context
 class FakeGL
     { // class FakeGL
@@ -154,6 +578,15 @@ class FakeGL
     // the maximum between viewport height and width
     float viewPortSize;
 
+    // the scissor box in pixels: its bottom left corner & size
+    int scissorX;
+    int scissorY;
+    int scissorWidth;
+    int scissorHeight;
+
+    // whether Scissor() has been called, before which the box follows the viewport as the window would
+    unsigned int scissorSet;
+
     //-----------------------------
     // ATTRIBUTE STATE
     //-----------------------------
@@ -171,6 +604,23 @@ class FakeGL
     // phong shading state
     unsigned int phongShading;
 
+    // face culling state, and which faces are culled & which winding faces the front
+    unsigned int cullFace;
+    unsigned int cullFaceMode;
+    unsigned int frontFace;
+
+    // scissor test state: only pixels inside the scissor box are drawn or cleared
+    unsigned int scissorTest;
+
+    // shading precision hint: FAKEGL_FAST shades with the approximations in FastMath.h
+    unsigned int shadingPrecision;
+
+    // deferred pipeline state: primitives are recorded and only drawn by Flush()
+    unsigned int deferredPipeline;
+
+    // visibility buffer state: Flush() rasterises triangles to IDs & barycentrics, then shades each visible pixel once
+    unsigned int visibilityShading;
+
     //-----------------------------
     // OUTPUT FROM INPUT STAGE
     // INPUT TO TRANSFORM STAGE
@@ -179,6 +629,94 @@ class FakeGL
     // we want a queue of vertices with attributes for passing to the rasteriser
     std::deque<vertexWithAttributes> vertexQueue;
 
+    //-----------------------------
+    // VERTEX ARRAY STATE
+    //-----------------------------
+
+    // client-side arrays set with the *Pointer() routines
+    vertexAttributeArray vertexArray;
+    vertexAttributeArray normalArray;
+    vertexAttributeArray texCoordArray;
+    vertexAttributeArray colourArray;
+
+    // the transformed vertices of the current DrawArrays() / DrawElements() call
+    // kept as a member so that the storage is reused between draws
+    // for DrawElements() this is indexed by array element & acts as a post-transform cache
+    // the normals & texture coordinates are only filled in when the state uses them
+    std::vector<screenVertexCore> vertexBatch;
+    std::vector<screenVertexNormal> vertexBatchNormals;
+    std::vector<screenVertexTexCoord> vertexBatchTexCoords;
+
+    // the draw in which each entry of vertexBatch was last transformed by DrawElements()
+    std::vector<unsigned int> vertexBatchDraw;
+
+    // the array elements DrawElements() has to transform this draw, in order of first use
+    std::vector<unsigned int> vertexBatchMisses;
+
+    // counts the DrawElements() calls, so stale cache entries can be spotted without clearing
+    unsigned int drawCount;
+
+    // post-transform cache statistics, accumulated until ResetVertexCacheStatistics()
+    unsigned long vertexCacheHits;
+    unsigned long vertexCacheMisses;
+
+    //-----------------------------
+    // DEFERRED PIPELINE STATE
+    //-----------------------------
+
+    // the batches recorded since the last Flush()
+    std::vector<deferredBatch> deferredBatches;
+
+    // the untransformed vertices of all the batches
+    std::vector<vertexWithAttributes> deferredVertices;
+
+    // the indices of all the indexed batches, relative to the batch's first vertex
+    std::vector<unsigned int> deferredIndices;
+
+    // the transformed vertices, filled in by Flush() for all the batches at once
+    // the normals & texture coordinates only for the batches whose state uses them
+    std::vector<screenVertexCore> deferredScreenVertices;
+    std::vector<screenVertexNormal> deferredScreenNormals;
+    std::vector<screenVertexTexCoord> deferredScreenTexCoords;
+
+    // maps array elements to recorded vertices while DrawElements() records a batch
+    std::vector<unsigned int> deferredRemap;
+
+    //-----------------------------
+    // VISIBILITY BUFFER STATE
+    //-----------------------------
+
+    // every triangle of the batches being flushed, indexed by triangle ID
+    // followed by the pieces of the clipped ones, added as tiles clip them, so under visibilityMutex
+    std::vector<visibilityTriangle> visibilityTriangles;
+
+    // the vertices of those pieces
+    std::vector<screenVertexWithAttributes> visibilityClipVertices;
+    std::mutex visibilityMutex;
+
+    // the nearest triangle at each pixel, row by row
+    // only sized while Flush() is using it, so that ProcessFragment() can tell
+    std::vector<visibilitySample> visibilityBuffer;
+
+    // ID of the first triangle of the batch being rasterised, or FAKEGL_NO_TRIANGLE to shade as usual
+    unsigned int visibilityBase;
+
+    //-----------------------------
+    // SHADER STATE
+    //-----------------------------
+
+    // the shader of the draw call in progress, or NULL to shade with the fixed-function shading
+    const void *boundShader;
+
+    // the vertex attributes it reads, as FAKEGL_ATTRIBUTE_* bits
+    unsigned int boundAttributes;
+
+    // whether the deferred pipeline was on before the draw call, which draws eagerly
+    unsigned int boundDeferred;
+
+    // the part of the state the fixed-function shading reads, taken once a batch by Begin() & RasteriseBatch()
+    shadingState rasterShading;
+
     //-----------------------------
     // TRANSFORM/LIGHTING STATE
     //-----------------------------
@@ -213,6 +751,30 @@ class FakeGL
     // the material emissive component 
     float emissiveMat[4];
 
+    // the material table, indexed by the material IDs vertices carry
+    std::vector<materialRecord> materials;
+
+    // finds the ID of a material already in the table
+    std::map<materialRecord, unsigned short> materialIDs;
+
+    // ID of the current material, which new vertices are given
+    unsigned short currentMaterial;
+
+    // set by Material*() until the next vertex, Begin() or draw call finds the new material's ID,
+    // so that setting several properties in a row only looks the result up once
+    unsigned int materialDirty;
+
+    // light direction & light-material products, redone whenever the light or the material changes
+    lightingConstants lightConstants;
+
+    // tables of cos^shininess for each shininess used, kept so that going back to one costs nothing
+    // there are never more than FAKEGL_MAX_SPECULAR_TABLES: the least recently used that nothing waiting to be drawn
+    // uses makes way for a new one, and when all are in use the new material goes without & fast shading uses FastPow()
+    std::map<float, specularTable> specularTables;
+
+    // counts the Flush() calls, after each of which only the current material's table is still in use
+    unsigned long flushCount;
+
     // the current normal
     Cartesian3 attributeNormal;
 
@@ -232,6 +794,9 @@ class FakeGL
     // stores desired point size
     float pointSize;
 
+    // the span of each row of a point of that size, bottom row first, worked out whenever the size changes
+    std::vector<pointSpan> pointSpans;
+
     // stores desired line width 
     float lineWidth;
 
@@ -241,6 +806,39 @@ class FakeGL
     //-----------------------------
     std::deque<fragmentWithAttributes> fragmentQueue;
 
+    //-----------------------------
+    // PARALLEL EXECUTION STATE
+    //-----------------------------
+
+    // the threads shared by the pipeline stages
+    ThreadPool threadPool;
+
+    // for each tile of the frame buffer, the primitives of the current batch that touch it
+    std::vector<std::vector<unsigned int> > tileBins;
+
+    // a fragment queue for each thread of the tiled rasteriser
+    std::vector<std::deque<fragmentWithAttributes> > threadFragments;
+
+    //-----------------------------
+    // RASTER STATISTICS
+    //-----------------------------
+
+    // triangle blocks found entirely outside, entirely inside, or straddling an edge
+    // accumulated until ResetRasterStatistics(), atomic because the tiled rasteriser updates them from every thread
+    std::atomic<unsigned long> blocksRejected;
+    std::atomic<unsigned long> blocksCovered;
+    std::atomic<unsigned long> blocksPartial;
+
+    // covered pixels that failed the early depth test, and so were never lit or textured
+    std::atomic<unsigned long> fragmentsShadingSkipped;
+
+    // triangles thrown away before raster setup, for facing the wrong way or lying outside the visible volume
+    std::atomic<unsigned long> trianglesFaceCulled;
+    std::atomic<unsigned long> trianglesFrustumCulled;
+
+    // triangles that crossed the near or far plane or left the guard band, and so were clipped
+    std::atomic<unsigned long> trianglesClipped;
+
     //-----------------------------
     // TEXTURE STATE
     //-----------------------------
@@ -266,8 +864,8 @@ class FakeGL
     // the clear colour initialised at 0 
     RGBAValue clearColour;
 
-    // depth buffer clear value initialised RGB at 0 and alpha at 1
-    RGBAValue depthColour;
+    // depth buffer clear value, initialised to the far plane
+    float clearDepth;
     
 	// the frame buffer itself
     RGBAImage frameBuffer;
@@ -276,9 +874,8 @@ class FakeGL
     float nearVal;
     float farVal;
      
-    // rather than define an extra class, we will cheat and use 
-    // a second RGBAImage in which the alpha stores the depth buffer
-    RGBAImage depthBuffer;
+    // the depth buffer, 24 bits per pixel unless changed with depthBuffer.SetFormat()
+    DepthBuffer depthBuffer;
     
     //-------------------------------------------------//
     //                                                 //
@@ -349,6 +946,9 @@ class FakeGL
     // sets the viewport
     void Viewport(int x, int y, int width, int height);
 
+    // sets the scissor box used when FAKEGL_SCISSOR_TEST is enabled
+    void Scissor(int x, int y, int width, int height);
+
     //-------------------------------------------------//
     //                                                 //
     // VERTEX ATTRIBUTE ROUTINES                       //
@@ -371,6 +971,50 @@ class FakeGL
     // sets the vertex & launches it down the pipeline
     void Vertex3f(float x, float y, float z);
 
+    //-------------------------------------------------//
+    //                                                 //
+    // VERTEX ARRAY ROUTINES                           //
+    //                                                 //
+    //-------------------------------------------------//
+
+    // enables a client-side vertex array
+    void EnableClientState(unsigned int array);
+
+    // disables a client-side vertex array
+    void DisableClientState(unsigned int array);
+
+    // sets the array of vertex positions (size is 2, 3 or 4)
+    void VertexPointer(int size, int stride, const float *pointer);
+
+    // sets the array of normals (always 3 floats)
+    void NormalPointer(int stride, const float *pointer);
+
+    // sets the array of texture coordinates (size is at least 2, extra components ignored)
+    void TexCoordPointer(int size, int stride, const float *pointer);
+
+    // sets the array of colours (size is 3 or 4)
+    void ColorPointer(int size, int stride, const float *pointer);
+
+    // draws count sequential vertices from the enabled arrays, starting at first
+    void DrawArrays(unsigned int mode, int first, int count);
+
+    // draws count vertices from the enabled arrays, looked up through indices
+    // each distinct index is only transformed once per call
+    void DrawElements(unsigned int mode, int count, const unsigned int *indices);
+
+    // the same, shading triangles with the given vertex & fragment shaders in place of lighting & texturing
+    // (see FakeGLShaders.h for what a shader provides); they are only known for the call, so it is never deferred
+    template <class VertexShader, class FragmentShader>
+    void DrawArrays(unsigned int mode, int first, int count, const VertexShader &vertexShader, const FragmentShader &fragmentShader);
+    template <class VertexShader, class FragmentShader>
+    void DrawElements(unsigned int mode, int count, const unsigned int *indices, const VertexShader &vertexShader, const FragmentShader &fragmentShader);
+
+    // fraction of DrawElements() vertices that were found already transformed
+    float VertexCacheHitRate() const;
+
+    // sets the post-transform cache statistics back to zero
+    void ResetVertexCacheStatistics();
+
     //-------------------------------------------------//
     //                                                 //
     // STATE VARIABLE ROUTINES                         //
@@ -382,6 +1026,21 @@ class FakeGL
     
     // enables a specific flag in the library
     void Enable(unsigned int property);
+
+    // sets which faces are culled when FAKEGL_CULL_FACE is enabled
+    void CullFace(unsigned int mode);
+
+    // sets which winding in screen space faces the front
+    void FrontFace(unsigned int mode);
+
+    // trades accuracy for speed: FAKEGL_SHADING_PRECISION may be FAKEGL_FAST or FAKEGL_NICEST
+    void Hint(unsigned int target, unsigned int mode);
+
+    // sets the number of threads used by the pipeline, 1 runs everything on the calling thread
+    void Threads(unsigned int threadCount);
+
+    // sets the raster statistics back to zero
+    void ResetRasterStatistics();
     
     //-------------------------------------------------//
     //                                                 //
@@ -392,6 +1051,28 @@ class FakeGL
     // sets properties for the one and only light
     void Light(int parameterName, const float *parameterValues);
 
+    // works out the lighting constants for the current light & material
+    void SetupLightingConstants();
+
+    // finds or adds the current material in the material table, and makes it the one new vertices are given
+    void SetCurrentMaterial();
+
+    // does the above if Material*() has changed the material since
+    void ResolveMaterial();
+
+    // finds or adds a material in the material table, returning its ID
+    unsigned short AddMaterial(const materialRecord &material);
+
+    // empties the full material table, drawing what was recorded first and giving the vertices still waiting new IDs
+    void RestartMaterials();
+
+    // finds or makes the table of cos^exponent for a material new vertices are given, and marks it in use until the next Flush()
+    // returns NULL when all FAKEGL_MAX_SPECULAR_TABLES are in use
+    const float *SpecularTable(float exponent);
+
+    // called when nothing recorded is left to draw, so that only the current material's specular table is in use
+    void ReleaseSpecularTables();
+
     //-------------------------------------------------//
     //                                                 //
     // TEXTURE PROCESSING ROUTINES                     //
@@ -426,8 +1107,21 @@ class FakeGL
     //-------------------------------------------------//
     
     // flushes the pipeline
+    // in deferred mode, this is where the recorded primitives are actually drawn
     void Flush();
 
+    // copies the state used to draw primitives
+    void SaveState(renderState &state);
+
+    // sets the state used to draw primitives
+    void RestoreState(const renderState &state);
+
+    // starts a new deferred batch with the current state
+    void BeginDeferredBatch(unsigned int mode);
+
+    // shades every pixel of the visibility buffer that a triangle covers
+    void ResolveVisibility();
+
     //-------------------------------------------------//
     //                                                 //
     // MAJOR PROCESSING ROUTINES                       //
@@ -437,20 +1131,149 @@ class FakeGL
     // transform one vertex & shift to the transformed queue
     void TransformVertex();
 
+    // transform a single vertex to screen space, leaving out the normal or texture coordinates if they are NULL
+    void TransformVertex(const vertexWithAttributes &vertex, screenVertexCore &screenVertex, screenVertexNormal *normal, screenVertexTexCoord *texCoord);
+
+    // the attributes beyond position & colour the current state needs, as FAKEGL_ATTRIBUTE_* bits:
+    // the normal & material for lighting, the texture coordinates for texturing
+    unsigned int VertexAttributes();
+
+    // whether the transform stage leaves the normals at unit length: fast fixed-function shading uses them as they are,
+    // so that they are normalised a chunk of vertices at a time instead of three at a time for each triangle
+    bool UnitNormals();
+
+    // maps a clip space position to the screen, keeping the z in view space, and sets the clip codes
+    void ProjectVertex(const Homogeneous4 &coordCS, float viewZ, screenVertexCore &screenVertex);
+
+    // the sides of the frame buffer, widened by a margin in pixels, mapped back to clip space as left, right, bottom, top
+    void FrameBounds(float margin, float bounds[4]);
+
+    // assembles a vertex from element index of the enabled arrays, with only the attributes given as FAKEGL_ATTRIBUTE_* bits
+    void FetchVertex(unsigned int index, vertexWithAttributes &vertex, unsigned int attributes);
+
+    // transforms count vertices into the parts a preallocated batch has, in chunks spread over the thread pool
+    void TransformBatch(const vertexWithAttributes *vertices, const screenVertexBatch &screenVertices, unsigned int count);
+
+    // fetches & transforms count array elements into the parts a batch has, in chunks spread over the thread pool
+    // without elements, element first + i goes to entry i; with them, element elements[i] goes to entry elements[i]
+    void TransformElements(int first, const unsigned int *elements, unsigned int count, const screenVertexBatch &batch);
+
+    // makes room for count entries in vertexBatch, & the arrays of whichever other parts the attributes given
+    // as FAKEGL_ATTRIBUTE_* bits need, and returns the batch they make up
+    screenVertexBatch VertexBatch(unsigned int count, unsigned int attributes);
+
+    // the batch made up of the deferred screen vertices from first on, with the parts the attributes need
+    screenVertexBatch DeferredScreenBatch(unsigned int first, unsigned int attributes);
+
+    // rasterises count vertices' worth of primitives from a batch of transformed vertices & processes their fragments
+    // vertices are taken in order, or looked up through indices if they are given
+    void RasteriseBatch(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, int count);
+
+    // rasterises the primitives in a batch with the thread pool, binning them by the tiles they touch
+    void RasteriseBatchTiled(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitiveCount);
+
+    // rasterises a single primitive of a batch, writing fragments inside the region to the queue
+    // the parts of its vertices are put together first, so the rasteriser sees whole vertices
+    void RasteriseBatchPrimitive(unsigned int mode, const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitive, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments);
+
+    // the number of vertices in a primitive
+    unsigned int PrimitiveSize(unsigned int mode);
+
+    // true if a triangle is culled for its facing or for lying outside the visible volume, which is counted
+    bool CullTriangle(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const screenVertexCore &vertex2);
+
+    // true if face culling is on and a triangle faces the culled way on screen
+    bool FaceCulled(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const screenVertexCore &vertex2);
+
+    // the same for a triangle of a batch
+    bool CullBatchTriangle(const screenVertexBatch &batch, const unsigned int *indices, unsigned int primitive);
+
+    // the region that may be drawn: the whole frame buffer, cut down to the scissor box if the test is on
+    // if nothing may be drawn, the region is empty, with its minima above its maxima
+    rasterRegion DrawRegion();
+
     // rasterise a single primitive if there are enough vertices on the queue
     bool RasterisePrimitive();
 
-    // rasterises a single point
-    void RasterisePoint(screenVertexWithAttributes &vertex0);
+    // rasterises a single point, writing the pixels inside the region
+    // nothing varies across a point, so it writes its spans straight to the frame buffer instead of queuing fragments
+    void RasterisePoint(const screenVertexCore &vertex0, const rasterRegion &region);
+
+    // works out the spans of a point of the current size
+    void SetupPointSpans();
 
-    // rasterises a single line segment
-    void RasteriseLineSegment(screenVertexWithAttributes &vertex0, screenVertexWithAttributes &vertex1);
+    // rasterises a single line segment, writing fragments inside the region to the queue
+    void RasteriseLineSegment(const screenVertexCore &vertex0, const screenVertexCore &vertex1, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments);
     
-    // rasterises a single triangle
-    void RasteriseTriangle(screenVertexWithAttributes &vertex0, screenVertexWithAttributes &vertex1, screenVertexWithAttributes &vertex2);
+    // rasterises a single triangle, writing fragments inside the region to the queue
+    // or, given a triangle ID, writing the pixels inside the region to the visibility buffer instead
+    void RasteriseTriangle(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID);
+
+    // the same for a triangle that needs no clipping, shaded by the given shader & specialised for the state
+    // given as FAKEGL_KERNEL bitflags, so that the per pixel loop tests no state
+    template <class Shader, unsigned int kernel>
+    void RasteriseTriangleKernel(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID);
+
+    // the kernels & the tables they are picked from by their bitflags
+    // the fixed-function shading is itself a shader, so that a draw call's shader has kernels of the same form
+    typedef void (FakeGL::*rasterKernel)(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID);
+    typedef RGBAValue (FakeGL::*shadeKernel)(const triangleShading &shading, float alpha, float beta, float gamma);
+    static const std::array<rasterKernel, FAKEGL_RASTER_KERNELS> rasterKernels;
+    static const std::array<shadeKernel, FAKEGL_SHADE_KERNELS> shadeKernels;
+
+    // the raster kernels for the draw call's shader, without & with the depth test
+    rasterKernel boundKernels[2];
+
+    // makes a shader the one triangles are shaded with until UnbindShader(), drawing what was deferred first
+    template <class Shader>
+    void BindShader(const Shader &shader);
+
+    // goes back to the fixed-function shading
+    void UnbindShader();
+
+    // fills the tables, with each entry the kernel for the bitflags it is indexed by
+    template <unsigned int... kernels>
+    static std::array<rasterKernel, sizeof...(kernels)> RasterKernels(std::integer_sequence<unsigned int, kernels...>);
+    template <unsigned int... kernels>
+    static std::array<shadeKernel, sizeof...(kernels)> ShadeKernels(std::integer_sequence<unsigned int, kernels...>);
+
+    // the FAKEGL_KERNEL bitflags for drawing with the given state
+    static unsigned int KernelFlags(unsigned int lighting, unsigned int phongShading, unsigned int texture, unsigned int texMode, unsigned int depthTest);
+
+    // the bitflags with those that make no difference cleared, so that combinations drawing alike share a kernel:
+    // Phong shading without lighting, & any shading for the visibility buffer
+    static constexpr unsigned int CanonicalKernel(unsigned int kernel)
+        { // CanonicalKernel()
+        return (kernel & FAKEGL_KERNEL_VISIBILITY) ? (kernel & (FAKEGL_KERNEL_VISIBILITY | FAKEGL_KERNEL_DEPTH_TEST)) :
+            (kernel & FAKEGL_KERNEL_LIGHTING) ? kernel : (kernel & ~FAKEGL_KERNEL_PHONG);
+        } // CanonicalKernel()
+
+    // clips a triangle against the planes its vertices lie outside in clip space, and rasterises the pieces
+    // given a triangle ID, each piece goes into the visibility buffer as a triangle of its own
+    void ClipTriangle(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID);
+
+    // the part of the current state, or of a recorded one, that shading a triangle reads
+    void ShadingState(shadingState &state);
+    void ShadingState(const renderState &recorded, shadingState &state);
+
+    // works out the per-triangle part of shading under the given state
+    void SetupTriangleShading(const shadingState &state, const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, triangleShading &shading);
+
+    // shades a point of a triangle given its barycentric coordinates, specialised for the state given as FAKEGL_KERNEL bitflags
+    template <unsigned int kernel>
+    RGBAValue ShadeTriangleFragment(const triangleShading &shading, float alpha, float beta, float gamma);
+
+    // cos^exponent for the specular term, from the material's table in fast shading when it has one
+    float SpecularPower(const float *specularPowers, unsigned int shadingPrecision, float cosSpec, float exponent);
     
-    // process a single fragment
+    // process a single fragment from the front of the queue
     void ProcessFragment();
+
+    // process a given fragment
+    void ProcessFragment(const fragmentWithAttributes &fragment);
+
+    // writes a run of pixels of one colour & depth along a row, as ProcessFragment() would each in turn
+    void WriteSpan(int row, int firstCol, int lastCol, const RGBAValue &colour, float depth);
     
     }; // class FakeGL
 
@@ -462,5 +1285,8 @@ std::ostream &operator << (std::ostream &outStream, vertexWithAttributes &vertex
 std::ostream &operator << (std::ostream &outStream, screenVertexWithAttributes &vertex); 
 std::ostream &operator << (std::ostream &outStream, fragmentWithAttributes &fragment); 
 
+// the shaders & the templated parts of the rasteriser, which need the whole class
+#include "FakeGLShaders.h"
+
 // include guard        
 #endif
\ No newline at end of file
@@ -231,6 +231,9 @@ void FakeGLRenderWidget::paintFakeGL()
     if (renderParameters->showObject)
         texturedObject->FakeGLRender(renderParameters, &fakeGL);
 
+    // the frame is finished, so draw anything the deferred pipeline has recorded
+    fakeGL.Flush();
+
     } // FakeGLRenderWidget::paintFakeGL()
     
 // mouse-handling
@@ -7,6 +7,9 @@ TEMPLATE = app
 TARGET = FakeGLRenderWindowRelease
 INCLUDEPATH += .
 
+# FakeGL builds its kernel tables with std::integer_sequence, which is C++14
+CONFIG += c++14
+
 # The following define makes your compiler warn you if you use any
 # feature of Qt which has been marked as deprecated (the exact warnings
 # depend on your compiler). Please consult the documentation of the
@@ -22,7 +25,10 @@ DEFINES += QT_DEPRECATED_WARNINGS
 HEADERS += ArcBall.h \
            ArcBallWidget.h \
            Cartesian3.h \
+           DepthBuffer.h \
            FakeGL.h \
+           FakeGLShaders.h \
+           FastMath.h \
            FakeGLRenderWidget.h \
            Homogeneous4.h \
            Matrix4.h \
@@ -33,11 +39,14 @@ HEADERS += ArcBall.h \
            RenderWindow.h \
            RGBAImage.h \
            RGBAValue.h \
-           TexturedObject.h
+           TexturedObject.h \
+           ThreadPool.h
 SOURCES += ArcBall.cpp \
            ArcBallWidget.cpp \
            Cartesian3.cpp \
+           DepthBuffer.cpp \
            FakeGL.cpp \
+           FastMath.cpp \
            FakeGLRenderWidget.cpp \
            Homogeneous4.cpp \
            main.cpp \
@@ -48,4 +57,5 @@ SOURCES += ArcBall.cpp \
            RenderWindow.cpp \
            RGBAImage.cpp \
            RGBAValue.cpp \
-           TexturedObject.cpp
+           TexturedObject.cpp \
+           ThreadPool.cpp
@@ -0,0 +1,529 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  FakeGLShaders.h
+//  ------------------------
+//  
+//  Shaders, & the templated parts of the rasteriser they are
+//  compiled into
+//
+//  DrawArrays() & DrawElements() can be given their own shading
+//  for triangles as a vertex shader & a fragment shader:
+//
+//      class myVertexShader
+//          {
+//          public:
+//          // the vertex attributes it reads, as FAKEGL_ATTRIBUTE_* bits
+//          // (the material ID comes with the normal)
+//          static const unsigned int attributes = FAKEGL_ATTRIBUTE_NORMAL;
+//
+//          // the values it hands on, interpolated over the triangle
+//          typedef shaderVaryings<3> varyings;
+//
+//          // works them out for a transformed vertex
+//          void operator () (const screenVertexWithAttributes &vertex, varyings &out) const;
+//          };
+//
+//      class myFragmentShader
+//          {
+//          public:
+//          // the colour of a pixel, from the interpolated values
+//          RGBAValue operator () (const myVertexShader::varyings &in) const;
+//          };
+//
+//  Their types are template parameters of the draw call, so both
+//  are compiled into the raster loop, with no call through a pointer
+//  per pixel.  Positions are still transformed, clipped & projected
+//  as usual, & points & lines are still drawn as usual.  The vertex
+//  shader is run on the corners of each triangle as it is set up,
+//  after clipping, as Gouraud shading's lighting is.  With several
+//  threads the shaders are called from all of them at once.
+//
+//  Underneath, the raster kernel shades through a shader class,
+//  which has a triangle type for what is worked out once per
+//  triangle, a constructor from the context, Setup() to work that
+//  out & Shade() to shade a point of the triangle from its
+//  barycentric coordinates.  vertexFragmentShader<> makes one from
+//  a pair of shaders, & fixedFunctionShader<> is the lighting &
+//  texturing of the fixed-function pipeline.
+//  
+///////////////////////////////////////////////////
+
+// include guard
+#ifndef FAKEGL_SHADERS_H
+#define FAKEGL_SHADERS_H
+
+#include "FakeGL.h"
+#include "FastMath.h"
+#include <cmath>
+#include <algorithm>
+
+// class for the values a vertex shader hands on to a fragment shader
+template <unsigned int count>
+class shaderVaryings
+    { // class shaderVaryings
+    public:
+    // the number of values
+    static const unsigned int size = count;
+
+    float values[count];
+
+    // access to a value
+    float &operator [] (unsigned int which)
+        { return values[which]; }
+    const float &operator [] (unsigned int which) const
+        { return values[which]; }
+    }; // class shaderVaryings
+
+// class for the shader made from a vertex shader & a fragment shader
+template <class VertexShader, class FragmentShader>
+class vertexFragmentShader
+    { // class vertexFragmentShader
+    public:
+    typedef typename VertexShader::varyings varyings;
+    static const unsigned int attributes = VertexShader::attributes;
+
+    // the values at the corners of a triangle
+    class triangle
+        { // class triangle
+        public:
+        varyings vertex0, vertex1, vertex2;
+        }; // class triangle
+
+    const VertexShader &vertexShader;
+    const FragmentShader &fragmentShader;
+
+    // constructor for the draw call
+    vertexFragmentShader(const VertexShader &vertexShader, const FragmentShader &fragmentShader)
+        : vertexShader(vertexShader), fragmentShader(fragmentShader)
+        { // constructor
+        } // constructor
+
+    // constructor for the raster kernel, from the shader the draw call bound
+    vertexFragmentShader(FakeGL &gl)
+        : vertexShader(((const vertexFragmentShader *) gl.boundShader)->vertexShader), 
+          fragmentShader(((const vertexFragmentShader *) gl.boundShader)->fragmentShader)
+        { // constructor
+        } // constructor
+
+    // runs the vertex shader on the corners, put together from their parts
+    void Setup(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, triangle &shading)
+        { // Setup()
+        screenVertexWithAttributes corner;
+        vertex0.Gather(corner);
+        vertexShader(corner, shading.vertex0);
+        vertex1.Gather(corner);
+        vertexShader(corner, shading.vertex1);
+        vertex2.Gather(corner);
+        vertexShader(corner, shading.vertex2);
+        } // Setup()
+
+    // interpolates the values & runs the fragment shader on them
+    RGBAValue Shade(const triangle &shading, float alpha, float beta, float gamma) const
+        { // Shade()
+        varyings fragment;
+        for (unsigned int value = 0; value < varyings::size; value++)
+            fragment[value] = alpha * shading.vertex0[value] + beta * shading.vertex1[value] + gamma * shading.vertex2[value];
+        return fragmentShader(fragment);
+        } // Shade()
+    }; // class vertexFragmentShader
+
+// class for the lighting & texturing of the fixed-function pipeline, for the state given as FAKEGL_KERNEL bitflags
+// (it shades with members of FakeGL.cpp, so only FakeGL.cpp's raster kernels use it)
+template <unsigned int kernel>
+class fixedFunctionShader
+    { // class fixedFunctionShader
+    public:
+    typedef triangleShading triangle;
+
+    // the context, & the part of its state the batch is shaded with
+    FakeGL &gl;
+    const shadingState &state;
+
+    // constructor
+    fixedFunctionShader(FakeGL &gl)
+        : gl(gl), state(gl.rasterShading)
+        { // constructor
+        } // constructor
+
+    // works out the lighting at the corners, or whatever Phong shading can work out in advance
+    void Setup(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, triangleShading &shading)
+        { // Setup()
+        gl.SetupTriangleShading(state, vertex0, vertex1, vertex2, shading);
+        } // Setup()
+
+    // shades a point of the triangle
+    RGBAValue Shade(const triangleShading &shading, float alpha, float beta, float gamma) const
+        { // Shade()
+        return gl.ShadeTriangleFragment<kernel>(shading, alpha, beta, gamma);
+        } // Shade()
+    }; // class fixedFunctionShader
+
+// a built in vertex shader for debugging, handing on the eye space normal
+class normalVertexShader
+    { // class normalVertexShader
+    public:
+    static const unsigned int attributes = FAKEGL_ATTRIBUTE_NORMAL;
+    typedef shaderVaryings<3> varyings;
+
+    void operator () (const screenVertexWithAttributes &vertex, varyings &out) const
+        { // operator ()
+        out[0] = vertex.normal.x;
+        out[1] = vertex.normal.y;
+        out[2] = vertex.normal.z;
+        } // operator ()
+    }; // class normalVertexShader
+
+// and the fragment shader to go with it, colouring each pixel by the unit normal, with -1 to 1 mapped to 0 to 255
+class normalFragmentShader
+    { // class normalFragmentShader
+    public:
+    RGBAValue operator () (const normalVertexShader::varyings &in) const
+        { // operator ()
+        Cartesian3 normal = Cartesian3(in[0], in[1], in[2]).unit();
+        return RGBAValue((normal.x + 1.0f) * 127.5f, (normal.y + 1.0f) * 127.5f, (normal.z + 1.0f) * 127.5f, 255.0f);
+        } // operator ()
+    }; // class normalFragmentShader
+
+// draws count sequential vertices from the enabled arrays, shading triangles with the given shaders
+template <class VertexShader, class FragmentShader>
+void FakeGL::DrawArrays(unsigned int mode, int first, int count, const VertexShader &vertexShader, const FragmentShader &fragmentShader)
+    { // DrawArrays()
+    vertexFragmentShader<VertexShader, FragmentShader> shader(vertexShader, fragmentShader);
+    BindShader(shader);
+    DrawArrays(mode, first, count);
+    UnbindShader();
+    } // DrawArrays()
+
+// draws count vertices from the enabled arrays looked up through indices, shading triangles with the given shaders
+template <class VertexShader, class FragmentShader>
+void FakeGL::DrawElements(unsigned int mode, int count, const unsigned int *indices, const VertexShader &vertexShader, const FragmentShader &fragmentShader)
+    { // DrawElements()
+    vertexFragmentShader<VertexShader, FragmentShader> shader(vertexShader, fragmentShader);
+    BindShader(shader);
+    DrawElements(mode, count, indices);
+    UnbindShader();
+    } // DrawElements()
+
+// makes a shader the one triangles are shaded with until UnbindShader(), drawing what was deferred first
+template <class Shader>
+void FakeGL::BindShader(const Shader &shader)
+    { // BindShader()
+    // the shader only lives as long as the draw call, so what was recorded before it is drawn now,
+    // keeping the order of drawing, and the draw call itself is drawn eagerly
+    Flush();
+    boundDeferred = deferredPipeline;
+    deferredPipeline = 0;
+
+    boundShader = &shader;
+    boundAttributes = Shader::attributes;
+    boundKernels[0] = &FakeGL::RasteriseTriangleKernel<Shader, 0>;
+    boundKernels[1] = &FakeGL::RasteriseTriangleKernel<Shader, FAKEGL_KERNEL_DEPTH_TEST>;
+    } // BindShader()
+
+// rasterises a triangle that needs no clipping, shaded by the given shader & specialised for the state
+// given as FAKEGL_KERNEL bitflags
+template <class Shader, unsigned int kernel>
+void FakeGL::RasteriseTriangleKernel(const screenVertexParts &vertex0, const screenVertexParts &vertex1, const screenVertexParts &vertex2, const rasterRegion &region, std::deque<fragmentWithAttributes> &fragments, unsigned int triangleID)
+    { // RasteriseTriangleKernel()
+    const bool visibility = (kernel & FAKEGL_KERNEL_VISIBILITY) != 0;
+
+    // snap the vertices to the sub-pixel grid, on which all of the coverage arithmetic is exact
+    const float subpixelScale = 1 << FAKEGL_SUBPIXEL_BITS;
+    long long x0 = std::llround(vertex0.core->position.x * subpixelScale), y0 = std::llround(vertex0.core->position.y * subpixelScale);
+    long long x1 = std::llround(vertex1.core->position.x * subpixelScale), y1 = std::llround(vertex1.core->position.y * subpixelScale);
+    long long x2 = std::llround(vertex2.core->position.x * subpixelScale), y2 = std::llround(vertex2.core->position.y * subpixelScale);
+
+    // twice the signed area, which is positive when the vertices run anticlockwise
+    long long area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+
+    // if it is zero, the vertices are collinear in projection and the triangle is edge on
+    // we can render that as a line, but the better solution is to render nothing.  In a surface, the adjacent
+    // triangles will eventually take care of it
+    if (area == 0)
+        return; 
+
+    // sets up the edge from vertex a to vertex b, turned round if need be so that it is positive inside
+    // the top & left edges own the pixels exactly on them, so that a pixel on an edge shared by two
+    // triangles belongs to exactly one of them
+    long long orientation = (area > 0) ? 1 : -1;
+    auto setupEdge = [&](long long xa, long long ya, long long xb, long long yb)
+        { // setupEdge()
+        // E(x, y) = a (x - xa) + b (y - ya), with the pixel samples on whole pixels of the grid
+        long long a = -orientation * (yb - ya), b = orientation * (xb - xa);
+        // a step of a whole pixel is a step of the grid's scale, which is multiplied in, as a & b can be negative
+        triangleEdge edge;
+        edge.columnStep = a * (1LL << FAKEGL_SUBPIXEL_BITS);
+        edge.rowStep = b * (1LL << FAKEGL_SUBPIXEL_BITS);
+        edge.origin = -a * xa - b * ya;
+        // with the inside on the left, the edge runs (b, -a): a left edge runs down, a top edge runs back along x
+        edge.limit = ((a > 0) || ((a == 0) && (b < 0))) ? -1 : 0;
+        return edge;
+        }; // setupEdge()
+
+    // each edge's value over the area is the barycentric coordinate of the vertex opposite
+    triangleEdge edge12 = setupEdge(x1, y1, x2, y2);
+    triangleEdge edge20 = setupEdge(x2, y2, x0, y0);
+    triangleEdge edge01 = setupEdge(x0, y0, x1, y1);
+    double inverseArea = 1.0 / (double) (orientation * area);
+
+    // the bounding box of the snapped vertices, in pixels
+    float minX = std::min(x0, std::min(x1, x2)) / subpixelScale, maxX = std::max(x0, std::max(x1, x2)) / subpixelScale;
+    float minY = std::min(y0, std::min(y1, y2)) / subpixelScale, maxY = std::max(y0, std::max(y1, y2)) / subpixelScale;
+
+    // create a fragment for reuse
+    fragmentWithAttributes rasterFragment;
+
+    // nothing after the rasteriser changes a fragment's depth, so whenever the depth test is on we can
+    // make it before shading, and skip the lighting & texturing of pixels that are already hidden
+    const bool earlyDepthTest = (kernel & FAKEGL_KERNEL_DEPTH_TEST) != 0;
+    rasterFragment.depthTested = earlyDepthTest;
+    unsigned long shadingSkipped = 0;
+
+    // work out the shading once for the whole triangle, unless it is only going into the visibility buffer
+    Shader shader(*this);
+    typename Shader::triangle shading;
+    if (!visibility)
+        shader.Setup(vertex0, vertex1, vertex2, shading);
+
+    // shades a covered pixel given its barycentric coordinates & depth, and queues the fragment
+    auto shadeFragment = [&](int row, int col, float alpha, float beta, float gamma, float depth)
+        { // shadeFragment()
+        // the early depth test
+        if (earlyDepthTest && !depthBuffer.TestAndSet(row, col, depth))
+            {
+            shadingSkipped++;
+            return;
+            }
+
+        // in the visibility buffer, all we keep is which triangle is nearest & where
+        if (visibility)
+            {
+            visibilitySample &sample = visibilityBuffer[row * frameBuffer.width + col];
+            sample.triangle = triangleID;
+            sample.alpha = alpha;
+            sample.beta = beta;
+            sample.gamma = gamma;
+            return;
+            }
+
+        rasterFragment.row = row;
+        rasterFragment.col = col;
+        rasterFragment.depth = depth;
+        rasterFragment.colour = shader.Shade(shading, alpha, beta, gamma);
+
+        // now we add it to the queue for fragment processing
+        fragments.push_back(rasterFragment);
+        }; // shadeFragment()
+
+    // clip the bounding box to the region before converting, comparing as floats first
+    // the pixel samples are on whole pixels, so the box runs from the first one inside it to the last
+    int startRow = (minY > region.minRow) ? (int) std::ceil(minY) : region.minRow;
+    int startCol = (minX > region.minCol) ? (int) std::ceil(minX) : region.minCol;
+    int endRow = (maxY < region.maxRow) ? (int) std::floor(maxY) : region.maxRow;
+    int endCol = (maxX < region.maxCol) ? (int) std::floor(maxX) : region.maxCol;
+
+    // the depth range, for turning interpolated z into a fragment depth
+    // the view space z runs from -near to -far, matching the near & far planes the triangle was clipped to
+    float depthRange = farVal - nearVal;
+
+    // the value of an edge at a pixel, exact in 64 bits
+    auto edgeAt = [](const triangleEdge &edge, int row, int col)
+        { // edgeAt()
+        return edge.origin + edge.columnStep * col + edge.rowStep * row;
+        }; // edgeAt()
+
+    // within a block, each edge changes by less than 2^25 from its value at the first pixel, so long as the
+    // vertices are inside the guard band; the pixels are stepped in 32 bit integers relative to that pixel,
+    // and the barycentric coordinates are the first pixel's plus the step scaled by the area
+    float inverse = inverseArea;
+    int columnStep12 = edge12.columnStep, columnStep20 = edge20.columnStep, columnStep01 = edge01.columnStep;
+    int rowStep12 = edge12.rowStep, rowStep20 = edge20.rowStep, rowStep01 = edge01.rowStep;
+
+    // the step from the first pixel that a pixel must exceed to be inside an edge, which is
+    // clamped to a range the steps never reach for edges that a whole block is inside or outside
+    auto threshold = [](const triangleEdge &edge, long long first)
+        { // threshold()
+        long long step = edge.limit - first;
+        return (int) std::max(-(1LL << 30), std::min(step, 1LL << 30));
+        }; // threshold()
+
+#ifdef FAKEGL_SSE2
+    // with SSE2 we test blocks of four pixels along a row at once, getting a mask of the covered ones
+    // every operation is the one the scalar loop does, so both keep exactly the same pixels
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0);
+    const __m128 allLanes = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    const __m128i laneIndex = _mm_set_epi32(3, 2, 1, 0);
+
+    // edge steps from one pixel to the next, and from one group of four to the next
+    const __m128i laneStep12 = _mm_set_epi32(3 * columnStep12, 2 * columnStep12, columnStep12, 0);
+    const __m128i laneStep20 = _mm_set_epi32(3 * columnStep20, 2 * columnStep20, columnStep20, 0);
+    const __m128i laneStep01 = _mm_set_epi32(3 * columnStep01, 2 * columnStep01, columnStep01, 0);
+    const __m128i groupStep12 = _mm_set1_epi32(4 * columnStep12);
+    const __m128i groupStep20 = _mm_set1_epi32(4 * columnStep20);
+    const __m128i groupStep01 = _mm_set1_epi32(4 * columnStep01);
+
+    const __m128 inverseVector = _mm_set1_ps(inverse);
+    const __m128 z0 = _mm_set1_ps(vertex0.core->position.z);
+    const __m128 z1 = _mm_set1_ps(vertex1.core->position.z);
+    const __m128 z2 = _mm_set1_ps(vertex2.core->position.z);
+    const __m128 nearPlane = _mm_set1_ps(nearVal);
+    const __m128 range = _mm_set1_ps(depthRange);
+
+    // per lane results, read back for the pixels that survive
+    alignas(16) float alphas[4], betas[4], gammas[4], depths[4];
+#endif
+
+    // rasterises the pixels of one block, skipping the edge tests if the block is known to be covered
+    auto rasteriseBlock = [&](int firstRow, int lastRow, int firstCol, int lastCol, bool covered)
+        { // rasteriseBlock()
+        long long first12 = edgeAt(edge12, firstRow, firstCol);
+        long long first20 = edgeAt(edge20, firstRow, firstCol);
+        long long first01 = edgeAt(edge01, firstRow, firstCol);
+        float firstAlpha = first12 * inverseArea;
+        float firstBeta = first20 * inverseArea;
+        float firstGamma = first01 * inverseArea;
+        int threshold12 = threshold(edge12, first12);
+        int threshold20 = threshold(edge20, first20);
+        int threshold01 = threshold(edge01, first01);
+
+#ifdef FAKEGL_SSE2
+        const __m128 firstAlphas = _mm_set1_ps(firstAlpha);
+        const __m128 firstBetas = _mm_set1_ps(firstBeta);
+        const __m128 firstGammas = _mm_set1_ps(firstGamma);
+        const __m128i thresholds12 = _mm_set1_epi32(threshold12);
+        const __m128i thresholds20 = _mm_set1_epi32(threshold20);
+        const __m128i thresholds01 = _mm_set1_epi32(threshold01);
+
+        int rowStepped12 = 0, rowStepped20 = 0, rowStepped01 = 0;
+        for (int row = firstRow; row <= lastRow; row++, rowStepped12 += rowStep12, rowStepped20 += rowStep20, rowStepped01 += rowStep01)
+            { // per row
+            __m128i step12 = _mm_add_epi32(_mm_set1_epi32(rowStepped12), laneStep12);
+            __m128i step20 = _mm_add_epi32(_mm_set1_epi32(rowStepped20), laneStep20);
+            __m128i step01 = _mm_add_epi32(_mm_set1_epi32(rowStepped01), laneStep01);
+
+            for (int col = firstCol; col <= lastCol; col += 4, 
+                step12 = _mm_add_epi32(step12, groupStep12), step20 = _mm_add_epi32(step20, groupStep20), step01 = _mm_add_epi32(step01, groupStep01))
+                { // per group of four
+                // the edge tests, and the lanes that run off the end of the row
+                __m128 inside = covered ? allLanes : _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(
+                    _mm_cmpgt_epi32(step12, thresholds12), _mm_cmpgt_epi32(step20, thresholds20)), _mm_cmpgt_epi32(step01, thresholds01)));
+                inside = _mm_and_ps(inside, _mm_castsi128_ps(_mm_cmplt_epi32(laneIndex, _mm_set1_epi32(lastCol - col + 1))));
+
+                // an empty group costs nothing more
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                // barycentric coordinates of the four pixels
+                __m128 alpha = _mm_add_ps(firstAlphas, _mm_mul_ps(_mm_cvtepi32_ps(step12), inverseVector));
+                __m128 beta = _mm_add_ps(firstBetas, _mm_mul_ps(_mm_cvtepi32_ps(step20), inverseVector));
+                __m128 gamma = _mm_add_ps(firstGammas, _mm_mul_ps(_mm_cvtepi32_ps(step01), inverseVector));
+
+                // depth, summed in the same order as the scalar code, and clipped
+                __m128 fragZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, z0), _mm_mul_ps(beta, z1)), _mm_mul_ps(gamma, z2));
+                __m128 depth = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, fragZ), nearPlane), range);
+                inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpngt_ps(depth, one), _mm_cmpnlt_ps(depth, zero)));
+                int coverage = _mm_movemask_ps(inside);
+
+                _mm_store_ps(alphas, alpha);
+                _mm_store_ps(betas, beta);
+                _mm_store_ps(gammas, gamma);
+                _mm_store_ps(depths, depth);
+
+                // visit the covered lanes only, lowest first so fragments come out in scan order
+                while (coverage != 0)
+                    { // per covered pixel
+                    int lane = FastLowestBit(coverage);
+                    coverage &= coverage - 1;
+                    shadeFragment(row, col + lane, alphas[lane], betas[lane], gammas[lane], depths[lane]);
+                    } // per covered pixel
+                } // per group of four
+            } // per row
+#else
+        int rowStepped12 = 0, rowStepped20 = 0, rowStepped01 = 0;
+        for (int row = firstRow; row <= lastRow; row++, rowStepped12 += rowStep12, rowStepped20 += rowStep20, rowStepped01 += rowStep01)
+            { // per row
+            int step12 = rowStepped12, step20 = rowStepped20, step01 = rowStepped01;
+            for (int col = firstCol; col <= lastCol; col++, step12 += columnStep12, step20 += columnStep20, step01 += columnStep01)
+                { // per pixel
+                // the edge tests, in integers
+                if (!covered && ((step12 <= threshold12) || (step20 <= threshold20) || (step01 <= threshold01)))
+                    continue;
+
+                // right - we have a pixel inside the frame buffer AND the triangle
+                // note we *COULD* compute gamma = 1.0 - alpha - beta instead
+                float alpha = firstAlpha + step12 * inverse;
+                float beta = firstBeta + step20 * inverse;
+                float gamma = firstGamma + step01 * inverse;
+
+                // compute the depth as an interpolated sum of the depth values of the three vertices
+                float fragZ = alpha * vertex0.core->position.z + beta * vertex1.core->position.z + gamma * vertex2.core->position.z;
+                // we then make the fragment range between 0 and 1 using near and far from projection
+                float depth = (-fragZ - nearVal) / depthRange;
+                
+                // clip the fragments out of clip space pixels here to save compute time
+                if (depth > 1 || depth < 0)
+                    continue;
+
+                shadeFragment(row, col, alpha, beta, gamma, depth);
+                } // per pixel
+            } // per row
+#endif
+        }; // rasteriseBlock()
+
+    // the coarse level: walk the box in blocks aligned to the frame buffer and classify each against the edges
+    // an edge is linear, so its extremes over a block are at the corners: if every corner of one edge is outside
+    // the block is rejected, and if every corner of every edge is inside, no pixel of the block needs testing
+    unsigned long rejected = 0, covered = 0, partial = 0;
+    for (int blockRow = (startRow / FAKEGL_RASTER_BLOCK) * FAKEGL_RASTER_BLOCK; blockRow <= endRow; blockRow += FAKEGL_RASTER_BLOCK)
+        { // per row of blocks
+        int firstRow = std::max(blockRow, startRow);
+        int lastRow = std::min(blockRow + FAKEGL_RASTER_BLOCK - 1, endRow);
+
+        for (int blockCol = (startCol / FAKEGL_RASTER_BLOCK) * FAKEGL_RASTER_BLOCK; blockCol <= endCol; blockCol += FAKEGL_RASTER_BLOCK)
+            { // per block
+            int firstCol = std::max(blockCol, startCol);
+            int lastCol = std::min(blockCol + FAKEGL_RASTER_BLOCK - 1, endCol);
+
+            // count the corners inside each edge, using the same test as the pixels
+            int inside0 = 0, inside1 = 0, inside2 = 0;
+            for (unsigned int corner = 0; corner < 4; corner++)
+                { // per corner
+                int row = (corner & 2) ? lastRow : firstRow;
+                int col = (corner & 1) ? lastCol : firstCol;
+                inside0 += (edgeAt(edge12, row, col) > edge12.limit);
+                inside1 += (edgeAt(edge20, row, col) > edge20.limit);
+                inside2 += (edgeAt(edge01, row, col) > edge01.limit);
+                } // per corner
+
+            if ((inside0 == 0) || (inside1 == 0) || (inside2 == 0))
+                rejected++;
+            else if ((inside0 == 4) && (inside1 == 4) && (inside2 == 4))
+                { // covered block
+                covered++;
+                rasteriseBlock(firstRow, lastRow, firstCol, lastCol, true);
+                } // covered block
+            else
+                { // partial block
+                partial++;
+                rasteriseBlock(firstRow, lastRow, firstCol, lastCol, false);
+                } // partial block
+            } // per block
+        } // per row of blocks
+
+    // one update per triangle keeps the shared counters off the per-block path
+    blocksRejected += rejected;
+    blocksCovered += covered;
+    blocksPartial += partial;
+    fragmentsShadingSkipped += shadingSkipped;
+    } // RasteriseTriangleKernel()
+
+// include guard
+#endif
@@ -0,0 +1,179 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  FastMath.cpp
+//  ------------------------
+//
+//  Approximations to pow(), 1/sqrt() & normalising, for
+//  shading when FAKEGL_SHADING_PRECISION is FAKEGL_FAST
+//
+///////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <cmath>
+#include <vector>
+#include <ostream>
+
+#include "FastMath.h"
+
+// scales count vectors to unit length in place, with vector(i) giving the i-th of them, however they are laid out
+template <class Vector> static void Normalise(Vector vector, unsigned int count)
+    { // Normalise()
+    unsigned int which = 0;
+#ifdef FAKEGL_SSE2
+    // four at a time: gather the components, so each line works on four vectors
+    for ( ; which + 4 <= count; which += 4)
+        {
+        Cartesian3 &v0 = vector(which), &v1 = vector(which + 1), &v2 = vector(which + 2), &v3 = vector(which + 3);
+        __m128 x = _mm_setr_ps(v0.x, v1.x, v2.x, v3.x);
+        __m128 y = _mm_setr_ps(v0.y, v1.y, v2.y, v3.y);
+        __m128 z = _mm_setr_ps(v0.z, v1.z, v2.z, v3.z);
+        __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+
+        // estimate, then one Newton step as in FastRsqrt()
+        __m128 estimate = _mm_rsqrt_ps(squared);
+        __m128 correction = _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), squared), _mm_mul_ps(estimate, estimate)));
+        estimate = _mm_mul_ps(estimate, correction);
+
+        float scale[4];
+        _mm_storeu_ps(scale, estimate);
+        v0 = v0 * scale[0];
+        v1 = v1 * scale[1];
+        v2 = v2 * scale[2];
+        v3 = v3 * scale[3];
+        }
+#endif
+    // and whatever is left one at a time
+    for ( ; which < count; which++)
+        vector(which) = FastUnit(vector(which));
+    } // Normalise()
+
+// scales count vectors to unit length in place
+void FastNormalise(Cartesian3 *vectors, unsigned int count)
+    { // FastNormalise()
+    Normalise([vectors](unsigned int which) -> Cartesian3 & { return vectors[which]; }, count);
+    } // FastNormalise()
+
+// the same for count vectors scattered through memory, such as the normals in an array of vertices
+void FastNormalise(Cartesian3 *const *vectors, unsigned int count)
+    { // FastNormalise()
+    Normalise([vectors](unsigned int which) -> Cartesian3 & { return *vectors[which]; }, count);
+    } // FastNormalise()
+
+// the largest absolute & relative errors seen in a sweep, & whether they are within the documented bound
+struct errorSweep
+    { // struct errorSweep
+    double absolute, relative;
+    errorSweep() : absolute(0.0), relative(0.0) {}
+    void Add(double approximate, double exact)
+        { // Add()
+        double error = std::fabs(approximate - exact);
+        absolute = std::max(absolute, error);
+        if (exact != 0.0)
+            relative = std::max(relative, error / std::fabs(exact));
+        } // Add()
+    bool Report(std::ostream &out, const char *name, const char *domain, bool isRelative, double bound) const
+        { // Report()
+        bool within = (isRelative ? relative : absolute) < bound;
+        out << name << " over " << domain << ": max absolute error " << absolute << ", max relative error " << relative 
+            << ", documented " << (isRelative ? "relative" : "absolute") << " bound " << bound << (within ? " ok" : " EXCEEDED") << std::endl;
+        return within;
+        } // Report()
+    }; // struct errorSweep
+
+// measures each approximation against the exact library call over the inputs shading gives it,
+// printing the largest errors next to the bounds documented in FastMath.h, and returning whether all are within them
+bool FastMathCheck(std::ostream &out)
+    { // FastMathCheck()
+    bool within = true;
+    const int samples = 1 << 20;
+
+    // FastLog2() over (0, 1], where the cosines & colours lie, and on up to 1024
+    errorSweep log2Sweep;
+    for (int sample = 1; sample <= samples; sample++)
+        {
+        float x = std::exp2(-30.0f + 40.0f * sample / samples);
+        log2Sweep.Add(FastLog2(x), std::log2((double) x));
+        }
+    within &= log2Sweep.Report(out, "FastLog2()", "[2^-30, 2^10]", false, 3.0e-5);
+
+    // FastExp2() over the powers FastPow() makes from those
+    errorSweep exp2Sweep;
+    for (int sample = 0; sample <= samples; sample++)
+        {
+        float y = -126.0f + 136.0f * sample / samples;
+        exp2Sweep.Add(FastExp2(y), std::exp2((double) y));
+        }
+    within &= exp2Sweep.Report(out, "FastExp2()", "[-126, 10]", true, 4.7e-6);
+
+    // FastPow() for the gamma curve & the largest shininess, with results well clear of underflow
+    const float exponents[] = { 1.065f, 128.0f };
+    for (float exponent : exponents)
+        {
+        errorSweep powSweep;
+        for (int sample = 1; sample <= samples; sample++)
+            {
+            float x = (float) sample / samples;
+            double exact = std::pow((double) x, (double) exponent);
+            if (exact > 1.0e-30)
+                powSweep.Add(FastPow(x, exponent), exact);
+            }
+        char name[32];
+        snprintf(name, sizeof(name), "FastPow(x, %g)", exponent);
+        within &= powSweep.Report(out, name, "(0, 1]", true, 2.1e-5 * exponent + 4.7e-6);
+        }
+
+    // FastRsqrt() over the squared lengths of normals, which the model view matrix may have scaled
+    errorSweep rsqrtSweep;
+    for (int sample = 0; sample <= samples; sample++)
+        {
+        float x = std::exp2(-20.0f + 40.0f * sample / samples);
+        rsqrtSweep.Add(FastRsqrt(x), 1.0 / std::sqrt((double) x));
+        }
+#ifdef FAKEGL_SSE2
+    within &= rsqrtSweep.Report(out, "FastRsqrt()", "[2^-20, 2^20]", true, 3.0e-7);
+#else
+    within &= rsqrtSweep.Report(out, "FastRsqrt()", "[2^-20, 2^20]", true, 1.8e-3);
+#endif
+
+    // FastNormalise() on vectors all round the sphere, at lengths from 1/1024 to 1024,
+    // in a batch with a remainder so that both the four at a time & the single paths run
+    std::vector<Cartesian3> vectors(samples + 3);
+    for (unsigned int which = 0; which < vectors.size(); which++)
+        {
+        float theta = 3.14159265f * (which % 1021) / 1021.0f, phi = 6.28318531f * (which % 1019) / 1019.0f;
+        float length = std::exp2(-10.0f + 20.0f * (which % 1013) / 1013.0f);
+        vectors[which] = Cartesian3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)) * length;
+        }
+    FastNormalise(&(vectors[0]), vectors.size());
+    errorSweep normaliseSweep;
+    for (const Cartesian3 &vector : vectors)
+        normaliseSweep.Add(std::sqrt((double) vector.x * vector.x + (double) vector.y * vector.y + (double) vector.z * vector.z), 1.0);
+#ifdef FAKEGL_SSE2
+    within &= normaliseSweep.Report(out, "FastNormalise() lengths", "[2^-10, 2^10]", true, 3.0e-7);
+#else
+    within &= normaliseSweep.Report(out, "FastNormalise() lengths", "[2^-10, 2^10]", true, 1.8e-3);
+#endif
+
+    // FastLookup() for cos^128 from a table as the specular highlights use
+    const int size = 1024;
+    float exponent = 128.0f;
+    std::vector<float> table(size + 1);
+    for (int entry = 0; entry <= size; entry++)
+        table[entry] = std::pow((float) entry / size, exponent);
+    errorSweep lookupSweep;
+    for (int sample = 0; sample <= samples; sample++)
+        {
+        float x = (float) sample / samples;
+        lookupSweep.Add(FastLookup(&(table[0]), size, x), std::pow((double) x, (double) exponent));
+        }
+    within &= lookupSweep.Report(out, "FastLookup() of x^128", "[0, 1]", false, exponent * (exponent - 1.0) / 8.0e6);
+
+    return within;
+    } // FastMathCheck()
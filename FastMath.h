@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  FastMath.h
+//  ------------------------
+//
+//  Approximations to pow(), 1/sqrt() & normalising, for
+//  shading when FAKEGL_SHADING_PRECISION is FAKEGL_FAST
+//
+//  Error bounds against the exact library calls, measured
+//  over the ranges shading uses:
+//      FastLog2()      absolute error below 3.0e-5
+//      FastExp2()      relative error below 4.7e-6
+//      FastPow()       relative error below 2.1e-5 * |y| + 4.7e-6,
+//                      so 2.4e-5 for the gamma curve & 2.6e-3 for shininess 128
+//      FastRsqrt()     relative error below 3e-7 with SSE, 1.8e-3 without
+//      FastNormalise() lengths within the same bounds of 1
+//      FastLookup()    for cos^n from 1024 intervals, absolute error
+//                      below n(n-1)/8e6, so 2e-3 for shininess 128
+//
+//  FastMathCheck() repeats the measurement, and is run by
+//  starting the program with --check-fast-math
+//
+///////////////////////////////////////////////////
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+
+// SSE2 paths are built whenever the compiler targets SSE2 (GCC & Clang say so with __SSE2__, MSVC for x64
+// or /arch:SSE2), unless FAKEGL_NO_SSE2 is defined to build the plain C++ paths instead, which cover the same pixels
+#if !defined(FAKEGL_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#define FAKEGL_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Cartesian3.h"
+
+// these are called per fragment, so they are defined here to be inlined,
+// & kept free of branches on the data so that loops over them can be vectorised
+
+// log2(x) for x > 0: the exponent field, plus a polynomial in the mantissa
+// (the sign is ignored, and 0 gives -127)
+inline float FastLog2(float x)
+    { // FastLog2()
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float exponent = (float) ((int) ((bits >> 23) & 0xFF) - 127);
+    // mantissa rescaled to [0, 1)
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float t;
+    memcpy(&t, &bits, sizeof(t));
+    t -= 1.0f;
+    // log2(1 + t) = t * q(t), which makes log2(1) exactly 0
+    float q = 0.0458871839f;
+    q = q * t - 0.194426288f;
+    q = q * t + 0.415424661f;
+    q = q * t - 0.708682904f;
+    q = q * t + 1.44182587f;
+    return exponent + t * q;
+    } // FastLog2()
+
+// 2^y: the integer part goes in the exponent field, the fraction through a polynomial
+inline float FastExp2(float y)
+    { // FastExp2()
+    // floor without a call
+    int whole = (int) y;
+    whole -= (y < (float) whole);
+    float fraction = y - (float) whole;
+    // 2^f = 1 + f * r(f)
+    float r = 0.0134928948f;
+    r = r * fraction + 0.0520749036f;
+    r = r * fraction + 0.241404284f;
+    r = r * fraction + 0.693018700f;
+    float mantissa = 1.0f + fraction * r;
+    // an exponent field of 0 gives 0 for underflow, & of 255 infinity for overflow
+    whole = std::min(std::max(whole, -127), 128);
+    unsigned int bits = (unsigned int) (whole + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return mantissa * scale;
+    } // FastExp2()
+
+// x^y for x >= 0, as 2^(y log2 x); like pow(), 0^0 is 1 and 0^y is 0 for y > 0,
+// which falls out of FastLog2(0) being -127 & FastExp2() going to 0 below 2^-127
+inline float FastPow(float x, float y)
+    { // FastPow()
+    return FastExp2(y * FastLog2(x));
+    } // FastPow()
+
+// 1/sqrt(x) for x > 0: a hardware or integer estimate, then one Newton step
+inline float FastRsqrt(float x)
+    { // FastRsqrt()
+#ifdef FAKEGL_SSE2
+    float estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    unsigned int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5F3759DF - (bits >> 1);
+    float estimate;
+    memcpy(&estimate, &bits, sizeof(estimate));
+#endif
+    return estimate * (1.5f - 0.5f * x * estimate * estimate);
+    } // FastRsqrt()
+
+// a vector scaled to unit length
+inline Cartesian3 FastUnit(const Cartesian3 &vector)
+    { // FastUnit()
+    return vector * FastRsqrt(vector.x * vector.x + vector.y * vector.y + vector.z * vector.z);
+    } // FastUnit()
+
+// a function over [0, 1] at x, interpolated from a table of its values at size + 1 evenly spaced points
+inline float FastLookup(const float *table, int size, float x)
+    { // FastLookup()
+    float position = x * size;
+    int index = std::min(std::max((int) position, 0), size - 1);
+    float fraction = position - (float) index;
+    return table[index] + fraction * (table[index + 1] - table[index]);
+    } // FastLookup()
+
+// the index of the lowest bit set in a non-zero mask, with whichever instruction the compiler has for it
+inline int FastLowestBit(unsigned int bits)
+    { // FastLowestBit()
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int) index;
+#else
+    int index = 0;
+    for ( ; (bits & 1) == 0; bits >>= 1)
+        index++;
+    return index;
+#endif
+    } // FastLowestBit()
+
+// scales count vectors to unit length in place
+void FastNormalise(Cartesian3 *vectors, unsigned int count);
+
+// the same for count vectors scattered through memory, such as the normals in an array of vertices
+void FastNormalise(Cartesian3 *const *vectors, unsigned int count);
+
+// measures the errors above against the exact library calls, printing them with the documented bounds,
+// and returns whether every one is within its bound
+bool FastMathCheck(std::ostream &out);
+
+#endif
@@ -32,6 +32,7 @@
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <map>
 
 // include the Cartesian 3- vector class
 #include "Cartesian3.h"
@@ -289,8 +290,59 @@ void TexturedObject::TransferAssetsToFakeGL(FakeGL *fakeGL)
     { // TransferAssetsToFakeGL()
     // this is much simpler in comparison because we only support one format
     fakeGL->TexImage2D(texture);
+
+    // and set up the vertex arrays for drawing
+    BuildVertexArrays();
     } // TransferAssetsToFakeGL()
 
+// routine to build the vertex arrays used by FakeGLRender
+void TexturedObject::BuildVertexArrays()
+    { // BuildVertexArrays()
+    // start from scratch
+    arrayVertices.resize(0);
+    arrayNormals.resize(0);
+    arrayTextureCoords.resize(0);
+    arrayIndices.resize(0);
+
+    // map from a vertex / normal / texture coordinate triple to its array index
+    std::map<std::vector<unsigned int>, unsigned int> arrayIDs;
+
+    // loop through the faces, triangulating them as fans in the same way as Render()
+    for (unsigned int face = 0; face < faceVertices.size(); face++)
+        { // per face
+        for (unsigned int triangle = 0; triangle < faceVertices[face].size() - 2; triangle++)
+            { // per triangle
+            for (unsigned int vertex = 0; vertex < 3; vertex++)
+                { // per vertex
+                // we always use the face's vertex 0
+                int faceVertex = 0;
+
+                // so if it isn't 0, we want to add the triangle base ID
+                if (vertex != 0)
+                    faceVertex = triangle + vertex;
+
+                // the triple identifying this corner
+                std::vector<unsigned int> triple(3);
+                triple[0] = faceVertices[face][faceVertex];
+                triple[1] = faceNormals[face][faceVertex];
+                triple[2] = faceTexCoords[face][faceVertex];
+
+                // add a new array entry the first time we see the triple
+                std::map<std::vector<unsigned int>, unsigned int>::iterator found = arrayIDs.find(triple);
+                if (found == arrayIDs.end())
+                    { // new triple
+                    found = arrayIDs.insert(std::make_pair(triple, (unsigned int) arrayVertices.size())).first;
+                    arrayVertices.push_back(vertices[triple[0]]);
+                    arrayNormals.push_back(normals[triple[1]]);
+                    arrayTextureCoords.push_back(textureCoords[triple[2]]);
+                    } // new triple
+
+                arrayIndices.push_back(found->second);
+                } // per vertex
+            } // per triangle
+        } // per face
+    } // BuildVertexArrays()
+
 // routine to render
 void TexturedObject::Render(RenderParameters *renderParameters)
     { // Render()
@@ -476,9 +528,6 @@ void TexturedObject::FakeGLRender(RenderParameters *renderParameters, FakeGL *fa
     emissiveColour[0]   = emissiveColour[1] = emissiveColour[2] = renderParameters->emissiveLight;
     emissiveColour[3]   = 1.0; // don't forget alpha
 
-    // start rendering
-    fakeGL->Begin(FAKEGL_TRIANGLES);
-
     // we assume a single material for the entire object
     fakeGL->Materialfv(FAKEGL_EMISSION, emissiveColour);
     fakeGL->Materialfv(FAKEGL_AMBIENT_AND_DIFFUSE, surfaceColour);
@@ -488,59 +537,90 @@ void TexturedObject::FakeGLRender(RenderParameters *renderParameters, FakeGL *fa
     // repeat this for colour - extra call, but saves if statements
     fakeGL->Color3f(surfaceColour[0], surfaceColour[1], surfaceColour[2]);
 
-    // loop through the faces: note that they may not be triangles, which complicates life
-    for (unsigned int face = 0; face < faceVertices.size(); face++)
-        { // per face
-        // on each face, treat it as a triangle fan starting with the first vertex on the face
-        for (unsigned int triangle = 0; triangle < faceVertices[face].size() - 2; triangle++)
-            { // per triangle
-            // now do a loop over three vertices
-            for (unsigned int vertex = 0; vertex < 3; vertex++)
-                { // per vertex
-                // we always use the face's vertex 0
-                int faceVertex = 0;
-
-                // so if it isn't 0, we want to add the triangle base ID
-                if (vertex != 0)
-                    faceVertex = triangle + vertex;
-
-                // now we use that ID to lookup
-                fakeGL->Normal3f
-                    (
-                    normals         [faceNormals    [face][faceVertex]  ].x,
-                    normals         [faceNormals    [face][faceVertex]  ].y,
-                    normals         [faceNormals    [face][faceVertex]  ].z
-                    );
-                    
-                // if we're using UVW colours, set both colour and material
-                if (renderParameters->mapUVWToRGB)
-                    { // set colour and material
-                    float *colourPointer = (float *) &(textureCoords[faceTexCoords[face][faceVertex]]);
-                    fakeGL->Materialfv(FAKEGL_AMBIENT_AND_DIFFUSE, colourPointer);
-                    fakeGL->Materialfv(FAKEGL_SPECULAR, colourPointer);
-                    fakeGL->Color3f(colourPointer[0], colourPointer[1], colourPointer[2]);
-                    } // set colour and material
-
-                // set the texture coordinate
-                fakeGL->TexCoord2f
-                    (
-                    textureCoords   [faceTexCoords  [face][faceVertex]  ].x,
-                    textureCoords   [faceTexCoords  [face][faceVertex]  ].y
-                    );
-                    
-                // and set the vertex position
-                fakeGL->Vertex3f
-                    (
-                    scale * vertices        [faceVertices   [face][faceVertex]].x,
-                    scale * vertices        [faceVertices   [face][faceVertex]].y,
-                    scale * vertices        [faceVertices   [face][faceVertex]].z
-                    );
-                } // per vertex
-            } // per triangle
-        } // per face
-
-    // close off the triangles
-    fakeGL->End();
+    // with a single material, we can send the whole object down the pipeline as vertex arrays
+    if (!renderParameters->mapUVWToRGB && !arrayIndices.empty())
+        { // vertex arrays
+        // the arrays hold unscaled positions, so scale with the matrix instead
+        // FakeGL normalises normals when lighting, so this doesn't affect the illumination
+        fakeGL->PushMatrix();
+        fakeGL->Scalef(scale, scale, scale);
+
+        // point FakeGL at our arrays
+        fakeGL->EnableClientState(FAKEGL_VERTEX_ARRAY);
+        fakeGL->EnableClientState(FAKEGL_NORMAL_ARRAY);
+        fakeGL->EnableClientState(FAKEGL_TEXTURE_COORD_ARRAY);
+        fakeGL->VertexPointer(3, sizeof(Cartesian3), (const float *) &(arrayVertices[0]));
+        fakeGL->NormalPointer(sizeof(Cartesian3), (const float *) &(arrayNormals[0]));
+        fakeGL->TexCoordPointer(3, sizeof(Cartesian3), (const float *) &(arrayTextureCoords[0]));
+
+        // and draw all of the triangles at once
+        fakeGL->DrawElements(FAKEGL_TRIANGLES, arrayIndices.size(), &(arrayIndices[0]));
+
+        // now put the state back
+        fakeGL->DisableClientState(FAKEGL_VERTEX_ARRAY);
+        fakeGL->DisableClientState(FAKEGL_NORMAL_ARRAY);
+        fakeGL->DisableClientState(FAKEGL_TEXTURE_COORD_ARRAY);
+        fakeGL->PopMatrix();
+        } // vertex arrays
+    else
+        { // immediate mode
+        // start rendering
+        fakeGL->Begin(FAKEGL_TRIANGLES);
+
+        // loop through the faces: note that they may not be triangles, which complicates life
+        for (unsigned int face = 0; face < faceVertices.size(); face++)
+            { // per face
+            // on each face, treat it as a triangle fan starting with the first vertex on the face
+            for (unsigned int triangle = 0; triangle < faceVertices[face].size() - 2; triangle++)
+                { // per triangle
+                // now do a loop over three vertices
+                for (unsigned int vertex = 0; vertex < 3; vertex++)
+                    { // per vertex
+                    // we always use the face's vertex 0
+                    int faceVertex = 0;
+
+                    // so if it isn't 0, we want to add the triangle base ID
+                    if (vertex != 0)
+                        faceVertex = triangle + vertex;
+
+                    // now we use that ID to lookup
+                    fakeGL->Normal3f
+                        (
+                        normals         [faceNormals    [face][faceVertex]  ].x,
+                        normals         [faceNormals    [face][faceVertex]  ].y,
+                        normals         [faceNormals    [face][faceVertex]  ].z
+                        );
+                        
+                    // if we're using UVW colours, set both colour and material
+                    if (renderParameters->mapUVWToRGB)
+                        { // set colour and material
+                        float *colourPointer = (float *) &(textureCoords[faceTexCoords[face][faceVertex]]);
+                        fakeGL->Materialfv(FAKEGL_AMBIENT_AND_DIFFUSE, colourPointer);
+                        fakeGL->Materialfv(FAKEGL_SPECULAR, colourPointer);
+                        fakeGL->Color3f(colourPointer[0], colourPointer[1], colourPointer[2]);
+                        } // set colour and material
+
+                    // set the texture coordinate
+                    fakeGL->TexCoord2f
+                        (
+                        textureCoords   [faceTexCoords  [face][faceVertex]  ].x,
+                        textureCoords   [faceTexCoords  [face][faceVertex]  ].y
+                        );
+                        
+                    // and set the vertex position
+                    fakeGL->Vertex3f
+                        (
+                        scale * vertices        [faceVertices   [face][faceVertex]].x,
+                        scale * vertices        [faceVertices   [face][faceVertex]].y,
+                        scale * vertices        [faceVertices   [face][faceVertex]].z
+                        );
+                    } // per vertex
+                } // per triangle
+            } // per face
+
+        // close off the triangles
+        fakeGL->End();
+        } // immediate mode
 
     // if we have texturing enabled, turn texturing back off 
     if (renderParameters->texturedRendering)
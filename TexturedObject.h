@@ -68,6 +68,15 @@ class TexturedObject
     // corresponding vector of texture coordinates
     std::vector<std::vector<unsigned int> > faceTexCoords;
 
+    // FakeGL vertex arrays have a single index per vertex, so we keep one entry for
+    // each distinct vertex / normal / texture coordinate triple used by the faces
+    std::vector<Cartesian3> arrayVertices;
+    std::vector<Cartesian3> arrayNormals;
+    std::vector<Cartesian3> arrayTextureCoords;
+
+    // and the triangulated faces as indices into them
+    std::vector<unsigned int> arrayIndices;
+
     // RGBA Image for storing a texture
     RGBAImage texture;
 
@@ -94,6 +103,9 @@ class TexturedObject
     
     // routine to transfer assets to Fake GL
     void TransferAssetsToFakeGL(FakeGL *fakeGL);
+
+    // routine to build the vertex arrays used by FakeGLRender
+    void BuildVertexArrays();
     
     // routine to render
     void Render(RenderParameters *renderParameters);
@@ -0,0 +1,138 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  ThreadPool.cpp
+//  ------------------------
+//  
+//  A minimal pool of worker threads for running the
+//  stages of the FakeGL pipeline in parallel
+//  
+///////////////////////////////////////////////////
+
+#include "ThreadPool.h"
+
+// constructor - starts with only the calling thread
+ThreadPool::ThreadPool()
+    :
+    task(NULL),
+    jobCount(0),
+    nextJob(0),
+    busyWorkers(0),
+    generation(0),
+    stopping(false)
+    { // constructor
+    } // constructor
+
+// destructor
+ThreadPool::~ThreadPool()
+    { // destructor
+    // shut down the workers
+    Resize(1);
+    } // destructor
+
+// sets the number of threads, counting the calling thread
+void ThreadPool::Resize(unsigned int threadCount)
+    { // Resize()
+    // we always have the calling thread
+    if (threadCount < 1)
+        threadCount = 1;
+
+    // nothing to do if the size is right
+    if (threadCount == Size())
+        return;
+
+    // stop any existing workers
+    { // lock
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    } // lock
+    taskReady.notify_all();
+    for (unsigned int worker = 0; worker < workers.size(); worker++)
+        workers[worker].join();
+    workers.clear();
+    stopping = false;
+
+    // with no workers left, we can start counting tasks again
+    generation = 0;
+
+    // and start the new ones, numbered from 1 as the caller is thread 0
+    for (unsigned int thread = 1; thread < threadCount; thread++)
+        workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, thread));
+    } // Resize()
+
+// the number of threads, counting the calling thread
+unsigned int ThreadPool::Size() const
+    { // Size()
+    return workers.size() + 1;
+    } // Size()
+
+// runs job(0 .. jobCount - 1) spread over the threads & returns when they are all done
+// jobs are handed out in order, but may complete in any order
+void ThreadPool::ParallelFor(unsigned int newJobCount, const std::function<void(unsigned int job, unsigned int thread)> &job)
+    { // ParallelFor()
+    // with no workers, or only one job, just do it here
+    if (workers.empty() || (newJobCount <= 1))
+        {
+        for (unsigned int index = 0; index < newJobCount; index++)
+            job(index, 0);
+        return;
+        }
+
+    // hand out the task
+    { // lock
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &job;
+    jobCount = newJobCount;
+    nextJob = 0;
+    busyWorkers = workers.size();
+    generation++;
+    } // lock
+    taskReady.notify_all();
+
+    // the calling thread works as well
+    RunJobs(0);
+
+    // then waits for the workers to finish
+    std::unique_lock<std::mutex> lock(mutex);
+    while (busyWorkers != 0)
+        taskDone.wait(lock);
+    task = NULL;
+    } // ParallelFor()
+
+// the loop run by each worker thread
+void ThreadPool::WorkerLoop(unsigned int thread)
+    { // WorkerLoop()
+    unsigned long lastGeneration = 0;
+    while (true)
+        { // per task
+        // wait for a new task or for the pool to shut down
+        { // lock
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping && (generation == lastGeneration))
+            taskReady.wait(lock);
+        if (stopping)
+            return;
+        lastGeneration = generation;
+        } // lock
+
+        RunJobs(thread);
+
+        // tell the caller when the last worker is done
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0)
+            taskDone.notify_one();
+        } // per task
+    } // WorkerLoop()
+
+// runs jobs from the current task until there are none left
+void ThreadPool::RunJobs(unsigned int thread)
+    { // RunJobs()
+    for (unsigned int job = nextJob++; job < jobCount; job = nextJob++)
+        (*task)(job, thread);
+    } // RunJobs()
@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////////
+//
+//  University of Leeds
+//  COMP 5812M Foundations of Modelling & Rendering
+//  User Interface for Coursework
+//
+//  September, 2020
+//
+//  ------------------------
+//  ThreadPool.h
+//  ------------------------
+//  
+//  A minimal pool of worker threads for running the
+//  stages of the FakeGL pipeline in parallel
+//  
+///////////////////////////////////////////////////
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// the class itself
+class ThreadPool
+    { // class ThreadPool
+    public:
+    // the worker threads - the calling thread also takes part, so there is one less than the size
+    std::vector<std::thread> workers;
+
+    // the work currently being shared out, called with the job and thread index
+    const std::function<void(unsigned int, unsigned int)> *task;
+
+    // the number of jobs in the current task & the next one to hand out
+    unsigned int jobCount;
+    std::atomic<unsigned int> nextJob;
+
+    // the number of workers still busy with the current task
+    unsigned int busyWorkers;
+
+    // incremented for each task, so that the workers can tell there's a new one
+    unsigned long generation;
+
+    // set when the workers should exit
+    bool stopping;
+
+    // synchronisation for handing out tasks and waiting for them to finish
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable taskDone;
+
+    // constructor - starts with only the calling thread
+    ThreadPool();
+
+    // destructor
+    ~ThreadPool();
+
+    // sets the number of threads, counting the calling thread
+    void Resize(unsigned int threadCount);
+
+    // the number of threads, counting the calling thread
+    unsigned int Size() const;
+
+    // runs job(0 .. jobCount - 1) spread over the threads & returns when they are all done
+    // jobs are handed out in order, but may complete in any order
+    void ParallelFor(unsigned int jobCount, const std::function<void(unsigned int job, unsigned int thread)> &job);
+
+    // the loop run by each worker thread
+    void WorkerLoop(unsigned int thread);
+
+    // runs jobs from the current task until there are none left
+    void RunJobs(unsigned int thread);
+    }; // class ThreadPool
+
+#endif
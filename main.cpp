@@ -18,6 +18,7 @@
 // system libraries
 #include <iostream>
 #include <fstream>
+#include <string>
 
 // QT
 #include <QApplication>
@@ -27,10 +28,15 @@
 #include "TexturedObject.h"
 #include "RenderParameters.h"
 #include "RenderController.h"
+#include "FastMath.h"
 
 // main routine
 int main(int argc, char **argv)
     { // main()
+    // check the shading approximations against their documented error bounds, without opening a window
+    if ((argc == 2) && (std::string(argv[1]) == "--check-fast-math"))
+        return FastMathCheck(std::cout) ? 0 : 1;
+
     // initialize QT
     QApplication renderApp(argc, argv);
 